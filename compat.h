@@ -80,6 +80,7 @@ u8 vid_which_vrm(void)
 	SIMPLE_DEV_PM_OPS(name, suspend_fn, resume_fn)
 
 static void __maybe_unused it87_resume_sio(struct platform_device *pdev);
+static int __maybe_unused it87_suspend(struct device *dev);
 static int __maybe_unused it87_resume(struct device *dev);
 #endif
 
@@ -87,4 +88,50 @@ static int __maybe_unused it87_resume(struct device *dev);
 #define pm_sleep_ptr(_ptr)	_ptr
 #endif
 
+#ifndef HWMON_CHANNEL_INFO
+/*
+ * New API in 5.1
+ */
+#define HWMON_CHANNEL_INFO(stype, ...)			\
+	(&(struct hwmon_channel_info) {			\
+		.type = hwmon_##stype,			\
+		.config = (u32 []) {			\
+			__VA_ARGS__, 0			\
+		}					\
+	})
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 10, 0)
+/*
+ * Sequence counters with an associated lock are new in 5.10
+ */
+#define seqcount_mutex_t			seqcount_t
+#define seqcount_mutex_init(s, lock)		seqcount_init(s)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+/*
+ * Binary attribute callbacks take a const attribute since 6.13, through
+ * read_new and bin_attrs_new until 6.16
+ */
+#define IT87_BIN_CONST	const
+#else
+#define IT87_BIN_CONST
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0) && \
+    LINUX_VERSION_CODE < KERNEL_VERSION(6, 16, 0)
+#define IT87_BIN_READ	read_new
+#define IT87_BIN_ATTRS	bin_attrs_new
+#else
+#define IT87_BIN_READ	read
+#define IT87_BIN_ATTRS	bin_attrs
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+/*
+ * iio_trigger_poll_chained() was renamed in 6.4
+ */
+#define iio_trigger_poll_nested	iio_trigger_poll_chained
+#endif
+
 #endif /* COMPAT_H */
@@ -71,8 +71,12 @@
 #include <linux/errno.h>
 #include <linux/err.h>
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
 #include <linux/sysfs.h>
 #include <linux/string.h>
+#include <linux/sort.h>
+#include <linux/sched.h>
 #include <linux/dmi.h>
 #include <linux/pci.h>
 #include <asm/processor.h>
@@ -80,7 +84,19 @@
 #include <linux/acpi.h>
 #include <linux/io.h>
 #include <linux/wmi.h>
+#if IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER)
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#define IT87_IIO
+#endif
 #include "compat.h"
+#include "it87_snapshot.h"
+
+#define CREATE_TRACE_POINTS
+#include "it87_trace.h"
 
 /* Defines fallbacks for processor models */
 #ifndef INTEL_SKYLAKE_L_MODEL
@@ -150,9 +166,21 @@ static struct platform_device *it87_pdev[2];
 #define ECIO_CMD_OBF    0x01  /* Status bit mask for output buffer is full */
 #define ECIO_CMD_IBF    0x02  /* Status bit mask for input buffer is full */
 #define ECIO_Burst_MASK 0x10  /* Status bit mask for burst tranfers */
+/*
+ * Burst mode is not used: the only H2RAM register accessed over ECIO is
+ * the SmartFan control byte at 0x947, so there is no run of reads to batch.
+ */
 
 /* Timeouts and retries */
-#define ECIO_STEP_TIMEOUT   (HZ)  /* ~1 second per wait */
+#define ECIO_STEP_TIMEOUT   (100 * NSEC_PER_MSEC) /* Deadline per wait */
+#define ECIO_SPIN_MIN_NS    (5 * NSEC_PER_USEC)   /* Busy polling, minimum */
+#define ECIO_SPIN_MAX_NS    (50 * NSEC_PER_USEC)  /* Busy polling, maximum */
+#define ECIO_SLEEP_MIN_US   20    /* First sleeping poll interval */
+#define ECIO_SLEEP_MAX_US   1000  /* Longest sleeping poll interval */
+#define ECIO_WAIT_BUCKETS   8     /* Wait time histogram, see ecio_wait_stats */
+#define ECIO_FAIL_LIMIT     3     /* Consecutive failures before degrading */
+#define ECIO_PROBE_MIN      HZ    /* First recovery probe */
+#define ECIO_PROBE_MAX      (30 * HZ) /* Longest recovery probe interval */
 
 /* Hidden window offsets by Intel PCH generation */
 #define IT87_HIDDEN_OFS_SKYLAKE         0x00EF2700u
@@ -212,11 +240,14 @@ static inline int superio_enter(int ioreg, bool noentry)
 	/*
 	 * Try to reserve ioreg and ioreg + 1 for exclusive access.
 	 */
-	if (!request_muxed_region(ioreg, 2, DRVNAME))
+	if (!request_muxed_region(ioreg, 2, DRVNAME)) {
+		trace_it87_superio_enter(ioreg, noentry, -EBUSY);
 		return -EBUSY;
+	}
 
 	if (!noentry)
 		__superio_enter(ioreg);
+	trace_it87_superio_enter(ioreg, noentry, 0);
 	return 0;
 }
 
@@ -227,6 +258,7 @@ static inline void superio_exit(int ioreg, bool noexit)
 		outb(0x02, ioreg + 1);
 	}
 	release_region(ioreg, 2);
+	trace_it87_superio_exit(ioreg, noexit);
 }
 
 /* PCI Read Routine */
@@ -318,6 +350,21 @@ static bool update_vbat;
 /* Not all BIOSes properly configure the PWM registers */
 static bool fix_pwm_polarity;
 
+/* Seconds between re-reads of the cached limit registers, 0 = never */
+static unsigned int limit_refresh;
+
+/* Milliseconds between background refreshes, 0 = refresh on demand */
+static unsigned int sample_interval;
+
+/* Milliseconds an expired reading may be served while it is refreshed */
+static unsigned int max_staleness;
+
+/* Time the usable register access paths at probe and use the fastest */
+static bool bench_backend;
+
+/* Also register an IIO device with a triggered buffer */
+static bool iio;
+
 /* Many IT87 constants specified below */
 
 /* Length of ISA address segment */
@@ -435,6 +482,38 @@ static const u16 IT87_REG_TEMP_SRC1[] = { 0x21d, 0x21e, 0x21f };
 #define NUM_PWM			    ARRAY_SIZE(IT87_REG_PWM)
 #define NUM_AUTO_PWM	    ARRAY_SIZE(IT87_REG_PWM)
 
+/*
+ * The register cache is split into classes which are refreshed
+ * independently, so that reading a single attribute only costs the
+ * register accesses of its own class.
+ */
+enum it87_cache_class {
+	IT87_CACHE_IN,		/* Voltages and voltage limits */
+	IT87_CACHE_FAN,		/* Fan speeds, limits and divisors */
+	IT87_CACHE_TEMP,	/* Temperatures, limits and offsets */
+	IT87_CACHE_PWM,		/* Fan control and automatic pwm registers */
+	IT87_CACHE_ALARM,	/* Alarms and beep enables */
+	IT87_CACHE_VID,		/* VID value */
+	IT87_CACHE_LIMIT,	/* Limits, offsets and automatic pwm points */
+	IT87_NUM_CACHE
+};
+
+#define IT87_CACHE_ALL		(BIT(IT87_NUM_CACHE) - 1)
+
+static const char * const it87_cache_names[IT87_NUM_CACHE] = {
+	"in", "fan", "temp", "pwm", "alarm", "vid", "limit"
+};
+
+/* Default cache lifetime of each class, and its limits, in ms */
+#define IT87_UPDATE_INTERVAL	1500
+#define IT87_ADC_CYCLE		100	/* A full conversion cycle of the ADC */
+#define IT87_MAX_INTERVAL	600000
+#define IT87_SAMPLER_IDLE	10	/* Unread periods until only alarms are sampled */
+
+/* SMBus lease: re-enable after this much idle time, or this much in total */
+#define IT87_SMBUS_IDLE		(HZ / 4)
+#define IT87_SMBUS_HOLD		HZ
+
 struct it87_devices {
 	const char *name;
 	const char * const model;
@@ -994,8 +1073,38 @@ struct it87_sio_data {
  * For each registered chip, we need to keep some data in memory.
  * The structure is dynamically allocated.
  */
+struct it87_cache {
+	bool valid;		/* true if the class registers are valid */
+	unsigned long last_updated;	/* In jiffies */
+};
+
+/* A register read of the precomputed refresh plan, see it87_build_plan() */
+struct it87_plan_entry {
+	void *dst;		/* Cached field the value is stored into */
+	u16 reg;
+	u8 size;		/* Size of the cached field in bytes */
+	u8 shift;		/* Position of the register value in the field */
+};
+
+struct it87_plan {
+	const struct it87_plan_entry *entries;
+	unsigned int count;
+	u16 mmio_lo, mmio_hi;	/* Span of memory mapped registers read */
+	u8 *vals;		/* Register values, per entry, until published */
+};
+
+enum it87_backend_id {
+	IT87_BACKEND_IO,	/* Port I/O */
+	IT87_BACKEND_BANKED,	/* Port I/O with bank select */
+	IT87_BACKEND_MMIO,	/* Direct MMIO (FEAT_MMIO) */
+	IT87_BACKEND_BRIDGE,	/* MMIO through the ISA bridge */
+	IT87_BACKEND_H2RAM,	/* Port I/O, H2RAM through the ISA bridge */
+	IT87_BACKEND_ECIO,	/* Port I/O, H2RAM through ECIO */
+	IT87_NUM_BACKEND
+};
+
 struct it87_data {
-	const struct attribute_group *groups[7];
+	const struct attribute_group *groups[8];
 	enum chips type;
 	u64 features;
 	u8 peci_mask;
@@ -1003,6 +1112,15 @@ struct it87_data {
 
 	u8 smbus_bitmap;	/* !=0 if SMBus needs to be disabled */
 	u8 saved_bank;		/* saved bank register value */
+	bool smbus_leased;	/* SMBus is disabled, see smbus_disable() */
+	unsigned long smbus_since;	/* jiffies, when it was disabled */
+	struct delayed_work smbus_work;	/* Re-enables SMBus */
+	unsigned long smbus_entries;	/* Times SMBus was disabled */
+	unsigned long smbus_saved;	/* Times a lease avoided that */
+	unsigned long smbus_forced;	/* Leases ended by IT87_SMBUS_HOLD */
+	int bank_session;	/* Nesting depth of bank sessions */
+	u8 bank_reg;		/* Bank register value within a session */
+	u8 bank_entry;		/* Bank register value to restore */
 	u8 ec_special_config;	/* EC special config register restore value */
 	u8 sioaddr;		/* SIO port address */
 
@@ -1010,9 +1128,19 @@ struct it87_data {
 	bool mmio_bridge;   /* ISA bridge MMIO without hybrid Access */
 	bool mmio_h2ram;    /* ISA bridge MMIO with hybrid access */
 	bool ecio_h2ram;    /* Extended ECIO ports with hybrid access. */
+	int bridge_session;	/* Nesting depth of bridge transactions */
+	int bridge_err;		/* Result of claiming the bridge slot */
+	u8 *shadow;		/* Copy of the MMIO window during a refresh */
+	bool shadow_valid;
+	u16 shadow_lo, shadow_hi;	/* Registers held in shadow */
 
 	int (*read)(struct it87_data *, u16);
 	void (*write)(struct it87_data *, u16, u8);
+	/* Backend accessors, wrapped by read/write */
+	int (*bus_read)(struct it87_data *, u16);
+	void (*bus_write)(struct it87_data *, u16, u8);
+	enum it87_backend_id backend;
+	u32 backend_ns[IT87_NUM_BACKEND];	/* Probe timings, per read */
 
 	const u8 *REG_FAN;
 	const u8 *REG_FANX;
@@ -1027,8 +1155,17 @@ struct it87_data {
 
 	unsigned short addr;
 	struct mutex update_lock;
-	bool valid;		/* true if following fields are valid */
-	unsigned long last_updated;	/* In jiffies */
+	seqcount_mutex_t seq;	/* Publication of refreshed classes */
+	struct it87_cache cache[IT87_NUM_CACHE];	/* Per class state */
+	unsigned int update_interval[IT87_NUM_CACHE];	/* ms, except limits */
+	struct delayed_work sampler;	/* Background refresh */
+	bool sampling;			/* sampler is scheduled or running */
+	unsigned long last_read;	/* jiffies, last sensor read */
+	unsigned long last_alarm_read;	/* jiffies, last alarm-only read */
+	struct work_struct revalidate_work;	/* Refresh expired classes */
+	atomic_t revalidate;		/* Classes to refresh */
+	struct device *hwmon_dev;	/* For alarm notifications */
+	struct it87_plan plan[IT87_NUM_CACHE];	/* Per class register reads */
 
 	u16 in_scaled;		/* Internal voltage sensors are scaled */
 	u16 in_internal;	/* Bitfield, internal sensors (for labels) */
@@ -1038,6 +1175,7 @@ struct it87_data {
 	u8 has_fan;		/* Bitfield, fans enabled */
 	u16 fan[NUM_FAN][2];	/* Register values, [nr][0]=fan, [1]=min */
 	u8 has_temp;		/* Bitfield, temp sensors enabled */
+	u8 has_temp_type;	/* Bitfield, temp sensors with a known type */
 	s8 temp[NUM_TEMP][4];	/* [nr][0]=temp, [1]=min, [2]=max, [3]=offset */
 	u8 num_temp_limit;	/* Number of temperature limit registers */
 	u8 num_temp_offset;	/* Number of temperature offset registers */
@@ -1045,6 +1183,7 @@ struct it87_data {
 	u8 sensor;		/* Register value (IT87_REG_TEMP_ENABLE) */
 	u8 extra;		/* Register value (IT87_REG_TEMP_EXTRA) */
 	u8 fan_div[NUM_FAN_DIV];/* Register encoding, shifted right */
+	u8 fan_div_reg;		/* Register value, decoded into fan_div */
 	bool has_vid;		/* True if VID supported */
 	u8 vid;			/* Register encoding, combined */
 	u8 vrm;
@@ -1307,8 +1446,10 @@ struct it87_h2ram_handle
 
 	u32 hidden_base;   		/* hidden base address for z390/skylake bridges */
 	bool hidden_ready;       /* hidden window ready/available */
+	void __iomem *hidden_va;	/* hidden window, mapped until release */
 	/* AMD/Intel: track currently programmed base to minimize churn */
 	u32 current_base;
+	unsigned long reprograms;	/* Window switches between slots */
 };
 
 /* Global MMIO bridge state tracking */
@@ -1507,11 +1648,10 @@ static void _save_regs(struct it87_h2ram_handle *h)
 		pci_reg_read(h->bridge, 0xD8, &h->ord8);
 		pci_reg_read(h->bridge, 0x98, &h->or98);
 		if (h->hidden_ready && h->hidden_base) {
-			void __iomem *hb = ioremap(h->hidden_base, 0x200);
+			void __iomem *hb = h->hidden_va;
 			if (hb) {
 				h->hidden_orig_0x40 = readl(hb + 0x40);
 				h->hidden_orig_0x44 = readl(hb + 0x44);
-				iounmap(hb);
 			} else {
 				h->hidden_orig_0x40 = 0;
 				h->hidden_orig_0x44 = 0;
@@ -1536,11 +1676,10 @@ static void _restore_regs(struct it87_h2ram_handle *h)
 	} else if (v == IT87_H2_VENDOR_INTEL) {
 		/* Mirror hidden first, then PCI config */
 		if (h->hidden_ready && h->hidden_base) {
-			void __iomem *hb = ioremap(h->hidden_base, 0x200);
+			void __iomem *hb = h->hidden_va;
 			if (hb) {
 				writel(h->hidden_orig_0x40, hb + 0x40);
 				writel(h->hidden_orig_0x44, hb + 0x44);
-				iounmap(hb);
 			}
 		}
 		pci_reg_write(h->bridge, 0xD8, h->ord8);
@@ -1601,11 +1740,10 @@ static void _restore_regs(struct it87_h2ram_handle *h)
 
 	/* Hidden-window mirror first if available */
 	if (h->hidden_ready) {
-		void __iomem *hb = ioremap(h->hidden_base, 0x200);
+		void __iomem *hb = h->hidden_va;
 		if (hb) {
 			writel(h->r98[idx], hb + 0x40);
 			writel(h->rd8[idx], hb + 0x44);
-			iounmap(hb);
 		}
 	}
 
@@ -1622,13 +1760,28 @@ static void _restore_regs(struct it87_h2ram_handle *h)
 
 static int _enable_slot(struct it87_h2ram_handle *h, int idx)
 {
+	bool traced = trace_it87_bridge_slot_enabled();
+	u64 start = 0;
+	u32 prev;
+	int ret;
 	u16 v;
 
 	if (!h || !h->bridge)return -ENODEV;
 	v = h->bridge->vendor;
-	if (v==IT87_H2_VENDOR_AMD)return 	_amd_enable_slot(h, idx);
-	if (v==IT87_H2_VENDOR_INTEL)return 	_intel_enable_slot(h, idx);
-	return -ENODEV;
+	prev = h->current_base;
+	if (traced)
+		start = ktime_get_ns();
+	if (v==IT87_H2_VENDOR_AMD)
+		ret = _amd_enable_slot(h, idx);
+	else if (v==IT87_H2_VENDOR_INTEL)
+		ret = _intel_enable_slot(h, idx);
+	else
+		return -ENODEV;
+	if (traced)
+		trace_it87_bridge_slot(v, idx, h->current_base,
+				       h->current_base != prev, ret,
+				       ktime_get_ns() - start);
+	return ret;
 }
 
 /* ----- compact internal API (per-bridge handle) ----- */
@@ -1670,6 +1823,9 @@ static int it87_h2_init(struct it87_h2ram_handle *h)
 					h->hidden_ready = false;
 					h->hidden_base = 0;
 				}
+				/* Keep the hidden window mapped, slots switch often */
+				if (h->hidden_ready)
+					h->hidden_va = ioremap(h->hidden_base, 0x200);
 			}
 			_save_regs(h);
 			return 0;
@@ -1725,6 +1881,7 @@ static int it87_h2_use_slot(struct it87_h2ram_handle *h, int idx)
 
 	/* Program window on demand for all vendors */
 	if (h->current_base != h->base[idx]) {
+		h->reprograms++;
 		return _enable_slot(h, idx);
 	}
 	return 0;
@@ -1734,6 +1891,10 @@ static void it87_h2_release(struct it87_h2ram_handle *h)
 {
 	if (!h || !h->bridge)return;
 	_restore_regs(h);
+	if (h->hidden_va) {
+		iounmap(h->hidden_va);
+		h->hidden_va = NULL;
+	}
 	pci_dev_put(h->bridge);
 	h->bridge = NULL;
 }
@@ -1816,49 +1977,105 @@ static inline void it87_ecio_outb(u8 value, u16 port)
  * ------------------------------------------------------------ */
 
 /*
- * Wait for IBF == 0 (input buffer empty, EC ready to accept a byte).
- * Returns 0 on success, -ETIMEDOUT on timeout.
+ * The ECIO ports are shared by everything using the EC, so the learned
+ * handshake latency and the wait statistics are kept for the EC as a whole.
+ * Updated with it87_ecio_lock held.
  */
-static int it87_ecio_wait_ibe(void)
-{
-	unsigned long deadline = jiffies + ECIO_STEP_TIMEOUT;
+struct it87_ecio_stats {
+	u64 avg_ns;		/* Moving average of successful waits */
+	unsigned long waits;
+	unsigned long slept;	/* Waits which had to sleep */
+	unsigned long timeouts;
+	unsigned long hist[ECIO_WAIT_BUCKETS];	/* < 1, 4, 16, ... 4096+ us */
+	unsigned int failures;	/* Consecutive failed transactions */
+	unsigned long trips;	/* Times the EC was marked degraded */
+	unsigned long rejected;	/* Accesses failed fast while degraded */
+};
 
-	while(time_before(jiffies, deadline)) {
-		u8 status = it87_ecio_inb(ECIO_CMD_STAT);
+static struct it87_ecio_stats it87_ecio_stats;
 
-		/* IBF clear => we can write next byte */
-		if (!(status & ECIO_CMD_IBF))
-			return 0;
+static void it87_ecio_account(s64 ns, bool slept)
+{
+	struct it87_ecio_stats *st = &it87_ecio_stats;
+	unsigned int bucket = 0;
+	u64 us = div_u64(ns, NSEC_PER_USEC);
 
-		cpu_relax();
-		udelay(10);
+	/* Power of 4 microsecond buckets */
+	while (us && bucket < ECIO_WAIT_BUCKETS - 1) {
+		us >>= 2;
+		bucket++;
 	}
 
-	return -ETIMEDOUT;
+	st->waits++;
+	st->hist[bucket]++;
+	if (slept)
+		st->slept++;
+	/* Average over roughly the last 8 waits */
+	st->avg_ns = st->avg_ns - (st->avg_ns >> 3) + (ns >> 3);
 }
 
 /*
- * Wait for OBF == 1 (output buffer full, data ready to read).
+ * Wait until the status bits in mask read as want.
+ *
+ * Most handshakes complete within a few microseconds, so poll busily for
+ * about twice the learned latency first, then fall back to sleeping polls
+ * with an increasing interval, until ECIO_STEP_TIMEOUT expires.
  * Returns 0 on success, -ETIMEDOUT on timeout.
  */
-static int it87_ecio_wait_obf(void)
+static int it87_ecio_wait(u8 mask, u8 want)
 {
-	unsigned long deadline = jiffies + ECIO_STEP_TIMEOUT;
+	struct it87_ecio_stats *st = &it87_ecio_stats;
+	unsigned int delay = ECIO_SLEEP_MIN_US;
+	ktime_t start = ktime_get();
+	bool slept = false;
+	s64 spin_ns, elapsed;
+
+	spin_ns = clamp_t(s64, 2 * st->avg_ns, ECIO_SPIN_MIN_NS,
+			  ECIO_SPIN_MAX_NS);
 
-	while(time_before(jiffies, deadline)) {
+	for (;;) {
 		u8 status = it87_ecio_inb(ECIO_CMD_STAT);
 
-		/* OBF set => data available in ECIO_DATA */
-		if (status & ECIO_CMD_OBF)
+		elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
+		if ((status & mask) == want) {
+			it87_ecio_account(elapsed, slept);
 			return 0;
+		}
+		if (elapsed > ECIO_STEP_TIMEOUT)
+			break;
+
+		if (elapsed < spin_ns) {
+			cpu_relax();
+			continue;
+		}
 
-		cpu_relax();
-		udelay(10);
+		usleep_range(delay, 2 * delay);
+		delay = min_t(unsigned int, 2 * delay, ECIO_SLEEP_MAX_US);
+		slept = true;
 	}
 
+	st->timeouts++;
 	return -ETIMEDOUT;
 }
 
+/*
+ * Wait for IBF == 0 (input buffer empty, EC ready to accept a byte).
+ * Returns 0 on success, -ETIMEDOUT on timeout.
+ */
+static int it87_ecio_wait_ibe(void)
+{
+	return it87_ecio_wait(ECIO_CMD_IBF, 0);
+}
+
+/*
+ * Wait for OBF == 1 (output buffer full, data ready to read).
+ * Returns 0 on success, -ETIMEDOUT on timeout.
+ */
+static int it87_ecio_wait_obf(void)
+{
+	return it87_ecio_wait(ECIO_CMD_OBF, ECIO_CMD_OBF);
+}
+
 /* ------------------------------------------------------------
  * Single-attempt EC-IO transactions (no mutex here)
  * ------------------------------------------------------------ */
@@ -1998,6 +2215,84 @@ static int it87_ecio_write_once(u16 offset, u8 value)
 	return 0;
 }
 
+/* ------------------------------------------------------------
+ * Circuit breaker
+ * ------------------------------------------------------------ */
+
+/*
+ * A wedged EC makes every transaction wait for the full step timeout, and
+ * a refresh issues many of them. After ECIO_FAIL_LIMIT consecutive failures
+ * the EC is marked degraded: accesses then fail at once without touching
+ * the ports, and a worker probes the EC with an increasing interval until
+ * it answers again. Failed reads return -EIO, and a refresh hitting one
+ * keeps the last good values of the class being read. Stores pass the
+ * error on to userspace.
+ */
+static bool it87_ecio_degraded;
+static unsigned long it87_ecio_probe_delay;
+
+static void it87_ecio_probe(struct work_struct *work);
+static DECLARE_DELAYED_WORK(it87_ecio_probe_work, it87_ecio_probe);
+
+/* Must be called with it87_ecio_lock held */
+static void it87_ecio_result(int err)
+{
+	struct it87_ecio_stats *st = &it87_ecio_stats;
+
+	if (!err) {
+		st->failures = 0;
+		return;
+	}
+	if (++st->failures < ECIO_FAIL_LIMIT || it87_ecio_degraded)
+		return;
+
+	pr_warn("ECIO not responding, failing accesses until it recovers\n");
+	WRITE_ONCE(it87_ecio_degraded, true);
+	st->trips++;
+	it87_ecio_probe_delay = ECIO_PROBE_MIN;
+	queue_delayed_work(system_wq, &it87_ecio_probe_work,
+			   it87_ecio_probe_delay);
+}
+
+/* Must be called with it87_ecio_lock held */
+static bool it87_ecio_reject(void)
+{
+	if (!it87_ecio_degraded)
+		return false;
+	it87_ecio_stats.rejected++;
+	return true;
+}
+
+static void it87_ecio_probe(struct work_struct *work)
+{
+	u8 value;
+	int err;
+
+	mutex_lock(&it87_ecio_lock);
+	err = it87_ecio_read_once(H2RAM_LOW_BOUND, &value);
+	if (!err) {
+		pr_info("ECIO responding again\n");
+		it87_ecio_stats.failures = 0;
+		WRITE_ONCE(it87_ecio_degraded, false);
+	} else {
+		it87_ecio_probe_delay = min(2 * it87_ecio_probe_delay,
+					    (unsigned long)ECIO_PROBE_MAX);
+		queue_delayed_work(system_wq, &it87_ecio_probe_work,
+				   it87_ecio_probe_delay);
+	}
+	mutex_unlock(&it87_ecio_lock);
+}
+
+/*
+ * Refreshes and stores check this before touching a chip behind the EC, so
+ * that they fail as a whole instead of issuing a series of rejected
+ * accesses and leaving the chip half updated.
+ */
+static bool it87_ec_degraded(const struct it87_data *data)
+{
+	return data->ecio_h2ram && READ_ONCE(it87_ecio_degraded);
+}
+
 /* ------------------------------------------------------------
  * Main Accessors
  * ------------------------------------------------------------ */
@@ -2006,7 +2301,8 @@ static int it87_ecio_write_once(u16 offset, u8 value)
  * it87_ecio_read
  *
  *  - reg is the EC offset (0x0100..0xFFFF)
- *  - Returns 0..255 (byte) on success
+ *  - Returns 0..255 (byte) on success, -EIO on timeout or if the EC is
+ *    degraded
  *
  */
 static int _it87_ecio_read(struct it87_data *data, u16 reg)
@@ -2018,7 +2314,12 @@ static int _it87_ecio_read(struct it87_data *data, u16 reg)
 
 	mutex_lock(&it87_ecio_lock);
 
-	err = it87_ecio_read_once(reg, &value);
+	if (it87_ecio_reject()) {
+		err = -EIO;
+	} else {
+		err = it87_ecio_read_once(reg, &value);
+		it87_ecio_result(err);
+	}
 
 	mutex_unlock(&it87_ecio_lock);
 
@@ -2030,7 +2331,7 @@ static int _it87_ecio_read(struct it87_data *data, u16 reg)
 		 value, reg);
 	}
 
-	return value;
+	return err ? -EIO : value;
 }
 
 /*
@@ -2049,7 +2350,12 @@ static void _it87_ecio_write(struct it87_data *data, u16 reg, u8 value)
 
 	mutex_lock(&it87_ecio_lock);
 
-	err = it87_ecio_write_once(reg, value);
+	if (it87_ecio_reject()) {
+		err = -EIO;
+	} else {
+		err = it87_ecio_write_once(reg, value);
+		it87_ecio_result(err);
+	}
 
 	mutex_unlock(&it87_ecio_lock);
 
@@ -2193,7 +2499,7 @@ static void _it87_io_write(struct it87_data *data, u16 reg, u8 value)
 	outb_p(value, data->addr + IT87_DATA_REG_OFFSET);
 }
 
-static int smbus_disable(struct it87_data *data)
+static int _smbus_disable(struct it87_data *data)
 {
 	int err;
 
@@ -2205,18 +2511,20 @@ static int smbus_disable(struct it87_data *data)
 		superio_outb(data->sioaddr, IT87_SPECIAL_CFG_REG,
 			     data->ec_special_config & ~data->smbus_bitmap);
 		superio_exit(data->sioaddr, has_noconf(data));
-		if (has_bank_sel(data) && !data->mmio)
+		if (has_bank_sel(data) &&
+		    (!data->mmio || data->backend == IT87_BACKEND_BANKED))
 			data->saved_bank = _it87_io_read(data, IT87_REG_BANK);
 	}
 	return 0;
 }
 
-static int smbus_enable(struct it87_data *data)
+static int _smbus_enable(struct it87_data *data)
 {
 	int err;
 
 	if (data->smbus_bitmap) {
-		if (has_bank_sel(data) && !data->mmio)
+		if (has_bank_sel(data) &&
+		    (!data->mmio || data->backend == IT87_BACKEND_BANKED))
 			_it87_io_write(data, IT87_REG_BANK, data->saved_bank);
 		err = superio_enter(data->sioaddr, has_noconf(data));
 		if (err)
@@ -2230,6 +2538,112 @@ static int smbus_enable(struct it87_data *data)
 	return 0;
 }
 
+/*
+ * SMBus leases
+ *
+ * Disabling and re-enabling SMBus shadowing takes a Super-I/O entry each
+ * time, which adds up for back to back accesses, e.g. a fan control daemon
+ * setting all PWM channels. So smbus_enable() doesn't re-enable it right
+ * away, but leaves that to a delayed work item once the chip has been left
+ * alone for IT87_SMBUS_IDLE, and smbus_disable() picks up a lease which is
+ * still running. To not starve the firmware, a lease is never extended
+ * beyond IT87_SMBUS_HOLD. If the Super-I/O ports are busy when the lease
+ * ends, the lease is kept and ending it is retried after IT87_SMBUS_IDLE.
+ * Must be called with data->update_lock held, except during initialization.
+ */
+static int it87_smbus_release(struct it87_data *data)
+{
+	int err;
+
+	err = _smbus_enable(data);
+	if (err)
+		return err;
+	data->smbus_leased = false;
+	return 0;
+}
+
+static void it87_smbus_retry(struct it87_data *data)
+{
+	mod_delayed_work(system_wq, &data->smbus_work, IT87_SMBUS_IDLE);
+}
+
+static int smbus_disable(struct it87_data *data)
+{
+	int err;
+
+	if (!data->smbus_bitmap)
+		return 0;
+
+	if (data->smbus_leased) {
+		data->smbus_saved++;
+		return 0;
+	}
+
+	err = _smbus_disable(data);
+	if (err)
+		return err;
+	data->smbus_leased = true;
+	data->smbus_since = jiffies;
+	data->smbus_entries++;
+	return 0;
+}
+
+static int smbus_enable(struct it87_data *data)
+{
+	unsigned long expires;
+	int err;
+
+	if (!data->smbus_leased)
+		return 0;
+
+	expires = data->smbus_since + IT87_SMBUS_HOLD;
+	if (!time_before(jiffies, expires)) {
+		data->smbus_forced++;
+		err = it87_smbus_release(data);
+		if (err)
+			it87_smbus_retry(data);
+		return err;
+	}
+
+	mod_delayed_work(system_wq, &data->smbus_work,
+			 min_t(unsigned long, IT87_SMBUS_IDLE,
+			       expires - jiffies));
+	return 0;
+}
+
+static void it87_smbus_work(struct work_struct *work)
+{
+	struct it87_data *data = container_of(to_delayed_work(work),
+					      struct it87_data, smbus_work);
+
+	mutex_lock(&data->update_lock);
+	if (data->smbus_leased && it87_smbus_release(data))
+		it87_smbus_retry(data);
+	mutex_unlock(&data->update_lock);
+}
+
+/* End the lease now, e.g. before suspend or on removal */
+static void it87_smbus_flush(struct it87_data *data)
+{
+	int err = 0;
+
+	cancel_delayed_work_sync(&data->smbus_work);
+	mutex_lock(&data->update_lock);
+	if (data->smbus_leased)
+		err = it87_smbus_release(data);
+	mutex_unlock(&data->update_lock);
+
+	/* Nothing may be queued from here on, so there is no retry */
+	if (err)
+		pr_warn("Failed to re-enable SMBus shadowing at 0x%x (%d)\n",
+			data->addr, err);
+}
+
+static void it87_smbus_stop(void *arg)
+{
+	it87_smbus_flush(arg);
+}
+
 static u8 it87_io_set_bank(struct it87_data *data, u8 bank)
 {
 	u8 _bank = bank;
@@ -2247,6 +2661,45 @@ static u8 it87_io_set_bank(struct it87_data *data, u8 bank)
 	return _bank;
 }
 
+/*
+ * Bank sessions
+ *
+ * Outside of a session, each banked access selects the bank and restores
+ * the previous one afterwards. Within a session the bank register is only
+ * written when the bank actually changes, and the bank which was selected
+ * when the session began is restored once at its end. Sessions nest, and
+ * are a no-op unless banked port I/O is in use.
+ * Must be called with data->update_lock held, except during initialization.
+ */
+static int it87_io_read(struct it87_data *data, u16 reg);
+
+static void it87_bank_begin(struct it87_data *data)
+{
+	if (!has_bank_sel(data) || data->bus_read != it87_io_read)
+		return;
+
+	if (data->bank_session++)
+		return;
+	data->bank_reg = _it87_io_read(data, IT87_REG_BANK);
+	data->bank_entry = data->bank_reg;
+}
+
+static void it87_bank_end(struct it87_data *data)
+{
+	if (!data->bank_session || --data->bank_session)
+		return;
+	if (data->bank_reg != data->bank_entry)
+		_it87_io_write(data, IT87_REG_BANK, data->bank_entry);
+}
+
+static void it87_bank_select(struct it87_data *data, u8 bank)
+{
+	if ((data->bank_reg >> 5) != bank) {
+		data->bank_reg = (data->bank_reg & 0x1f) | (bank << 5);
+		_it87_io_write(data, IT87_REG_BANK, data->bank_reg);
+	}
+}
+
 /*
  * Must be called with data->update_lock held, except during initialization.
  * Must be called with SMBus accesses disabled.
@@ -2258,6 +2711,11 @@ static int it87_io_read(struct it87_data *data, u16 reg)
 	u8 bank;
 	int val;
 
+	if (data->bank_session) {
+		it87_bank_select(data, reg >> 8);
+		return _it87_io_read(data, reg & 0xff);
+	}
+
 	bank = it87_io_set_bank(data, reg >> 8);
 	val = _it87_io_read(data, reg & 0xff);
 	it87_io_set_bank(data, bank);
@@ -2275,6 +2733,12 @@ static void it87_io_write(struct it87_data *data, u16 reg, u8 value)
 {
 	u8 bank;
 
+	if (data->bank_session) {
+		it87_bank_select(data, reg >> 8);
+		_it87_io_write(data, reg & 0xff, value);
+		return;
+	}
+
 	bank = it87_io_set_bank(data, reg >> 8);
 	_it87_io_write(data, reg & 0xff, value);
 	it87_io_set_bank(data, bank);
@@ -2293,81 +2757,171 @@ static void it87_mmio_write(struct it87_data *data, u16 reg, u8 value)
 	writeb(value, data->mmio + reg);
 }
 
-/* ISA bridge MMIO accessors */
-static int it87_bridge_read(struct it87_data *data, u16 reg)
+/*
+ * ISA bridge transactions
+ *
+ * The bridge window is shared by both chips on dual chip boards. A
+ * transaction takes mmio_lock and switches the window to this chip's slot
+ * once, so that a batch of accesses (a refresh, or a store handler) doesn't
+ * pay for that on every register. Transactions nest.
+ * Must be called with data->update_lock held, except during initialization.
+ */
+static bool it87_has_bridge(const struct it87_data *data)
 {
-	if (data->mmio &&
-		!(data->features & FEAT_MMIO) &&
-		it87_h2_global_ready &&
-		(data->mmio_bridge || data->mmio_h2ram)) {
-		int slot = (data->sioaddr==REG_4E) ? 1 : 0;
-		int val = 0;
-
-		mutex_lock(&mmio_lock);
-
-		if (!it87_h2_global_use_slot(slot)) {
-			val = it87_mmio_read(data, reg);
-		}
-		mutex_unlock(&mmio_lock);
-		return val;
-	}
-	return 0;
+	return data->mmio && !(data->features & FEAT_MMIO) &&
+	       it87_h2_global_ready &&
+	       (data->mmio_bridge || data->mmio_h2ram);
 }
 
-static void it87_bridge_write(struct it87_data *data, u16 reg, u8 value)
+static int it87_bridge_slot(const struct it87_data *data)
 {
-	if (data->mmio &&
-		!(data->features & FEAT_MMIO) &&
-		it87_h2_global_ready &&
-		(data->mmio_bridge || data->mmio_h2ram)) {
-		int slot = (data->sioaddr==REG_4E) ? 1 : 0;
+	return (data->sioaddr == REG_4E) ? 1 : 0;
+}
+
+/*
+ * Slot affinity
+ *
+ * On dual chip boards, interleaved accesses to both chips would switch the
+ * window back and forth all the time. So before switching away from the
+ * other chip's slot, refresh whatever of its cache is about to expire while
+ * the window still points at it, so that it doesn't need the window back
+ * right away. This is only done by refreshes, so that stores don't pay for
+ * the other chip, and is best effort: if the other chip is busy, it is left
+ * alone. Devices are registered, by slot, under mmio_lock.
+ */
+#define IT87_BRIDGE_AHEAD	(HZ / 2)
 
-		mutex_lock(&mmio_lock);
+static struct it87_data *it87_bridge_devs[2];
 
-		if (it87_h2_global_use_slot(slot)) {
-			mutex_unlock(&mmio_lock);
-			return;
-		}
-		it87_mmio_write(data, reg, value);
+static unsigned int it87_stale_classes(struct it87_data *data,
+				       unsigned int classes,
+				       unsigned long ahead);
+static int it87_refresh(struct it87_data *data, unsigned int classes);
+
+static void it87_bridge_prefetch(struct it87_data *data)
+{
+	int slot = it87_bridge_slot(data);
+	struct it87_data *other;
+	unsigned int classes;
+
+	mutex_lock(&mmio_lock);
+	other = it87_bridge_devs[!slot];
+	if (!other || !it87_h2_global.have[!slot] ||
+	    it87_h2_global.current_base != it87_h2_global.base[!slot] ||
+	    !mutex_trylock(&other->update_lock)) {
 		mutex_unlock(&mmio_lock);
+		return;
 	}
+	mutex_unlock(&mmio_lock);
+
+	classes = it87_stale_classes(other, IT87_CACHE_ALL,
+				     IT87_BRIDGE_AHEAD);
+	if (classes)
+		it87_refresh(other, classes);
+	mutex_unlock(&other->update_lock);
 }
 
-/* Hybrid H2RAM access:
- *   0x000–0x7FF : legacy EC I/O (banked)
- *   0x800–0xFFF : MMIO via H2RAM window
- */
-static int it87_h2ram_read(struct it87_data *data, u16 reg)
+static int it87_bridge_begin(struct it87_data *data)
 {
-	if (reg >= H2RAM_LOW_BOUND && reg <= H2RAM_HI_BOUND) {
-		/* High region: go through MMIO window */
-		return it87_bridge_read(data, reg);
-	}
-	/* Low region: conventional EC I/O path */
-	return _it87_io_read(data, reg);
+	if (!it87_has_bridge(data))
+		return -ENODEV;
+
+	if (data->bridge_session++)
+		return data->bridge_err;
+
+	mutex_lock(&mmio_lock);
+	data->bridge_err = it87_h2_global_use_slot(it87_bridge_slot(data));
+	return data->bridge_err;
 }
 
-static void it87_h2ram_write(struct it87_data *data, u16 reg, u8 value)
+static void it87_bridge_end(struct it87_data *data)
 {
-	if (reg >= H2RAM_LOW_BOUND && reg <= H2RAM_HI_BOUND) {
-		/* High region: go through MMIO window */
-		it87_bridge_write(data, reg, value);
+	if (!data->bridge_session || --data->bridge_session)
 		return;
-	}
-	/* Low region: conventional EC I/O path */
-	_it87_io_write(data, reg, value);
+	mutex_unlock(&mmio_lock);
 }
 
-/* ECIO + Conventional I/O path */
-static int it87_ecio_read(struct it87_data *data, u16 reg)
+static void it87_bridge_unregister(void *arg)
 {
-	/* High region: go through ECIO window if hybrid ECIO is active */
-	if(reg>=H2RAM_LOW_BOUND && reg<=H2RAM_HI_BOUND && data->ecio_h2ram) {
-		return _it87_ecio_read(data, reg);
-	}
+	struct it87_data *data = arg;
 
-	/* Low region (or no ECIO hybrid): conventional EC I/O path */
-	return _it87_io_read(data, reg);
+	mutex_lock(&mmio_lock);
+	it87_bridge_devs[it87_bridge_slot(data)] = NULL;
+	mutex_unlock(&mmio_lock);
+
+	/* Wait for a prefetch on behalf of the other chip to finish */
+	mutex_lock(&data->update_lock);
+	mutex_unlock(&data->update_lock);
+}
+
+/* Make the device available for prefetching, once it is fully set up */
+static int it87_bridge_register(struct device *dev)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+
+	if (!it87_has_bridge(data))
+		return 0;
+
+	mutex_lock(&mmio_lock);
+	it87_bridge_devs[it87_bridge_slot(data)] = data;
+	mutex_unlock(&mmio_lock);
+
+	return devm_add_action_or_reset(dev, it87_bridge_unregister, data);
+}
+
+/* ISA bridge MMIO accessors */
+static int it87_bridge_read(struct it87_data *data, u16 reg)
+{
+	int val = -EIO;
+
+	if (!it87_bridge_begin(data))
+		val = it87_mmio_read(data, reg);
+	it87_bridge_end(data);
+	return val;
+}
+
+static void it87_bridge_write(struct it87_data *data, u16 reg, u8 value)
+{
+	if (!it87_bridge_begin(data))
+		it87_mmio_write(data, reg, value);
+	it87_bridge_end(data);
+}
+
+/* Hybrid H2RAM access:
+ *   0x000–0x7FF : legacy EC I/O (banked)
+ *   0x800–0xFFF : MMIO via H2RAM window
+ */
+static int it87_h2ram_read(struct it87_data *data, u16 reg)
+{
+	if (reg >= H2RAM_LOW_BOUND && reg <= H2RAM_HI_BOUND) {
+		/* High region: go through MMIO window */
+		return it87_bridge_read(data, reg);
+	}
+	/* Low region: conventional EC I/O path */
+	return _it87_io_read(data, reg);
+}
+
+static void it87_h2ram_write(struct it87_data *data, u16 reg, u8 value)
+{
+	if (reg >= H2RAM_LOW_BOUND && reg <= H2RAM_HI_BOUND) {
+		/* High region: go through MMIO window */
+		it87_bridge_write(data, reg, value);
+		return;
+	}
+	/* Low region: conventional EC I/O path */
+	_it87_io_write(data, reg, value);
+}
+
+/* ECIO + Conventional I/O path */
+static int it87_ecio_read(struct it87_data *data, u16 reg)
+{
+	/* High region: go through ECIO window if hybrid ECIO is active */
+	if(reg>=H2RAM_LOW_BOUND && reg<=H2RAM_HI_BOUND && data->ecio_h2ram) {
+		return _it87_ecio_read(data, reg);
+	}
+
+	/* Low region (or no ECIO hybrid): conventional EC I/O path */
+	return _it87_io_read(data, reg);
 }
 
 static void it87_ecio_write(struct it87_data *data, u16 reg, u8 value)
@@ -2382,55 +2936,157 @@ static void it87_ecio_write(struct it87_data *data, u16 reg, u8 value)
 	_it87_io_write(data, reg, value);
 }
 
-static void it87_update_pwm_ctrl(struct it87_data *data, int nr)
+/* ----- Backend selection ----- */
+
+static const struct it87_backend {
+	const char *name;
+	int (*read)(struct it87_data *, u16);
+	void (*write)(struct it87_data *, u16, u8);
+} it87_backends[IT87_NUM_BACKEND] = {
+	[IT87_BACKEND_IO] = { "io", _it87_io_read, _it87_io_write },
+	[IT87_BACKEND_BANKED] = { "banked", it87_io_read, it87_io_write },
+	[IT87_BACKEND_MMIO] = { "mmio", it87_mmio_read, it87_mmio_write },
+	[IT87_BACKEND_BRIDGE] = { "bridge", it87_bridge_read,
+				  it87_bridge_write },
+	[IT87_BACKEND_H2RAM] = { "h2ram", it87_h2ram_read, it87_h2ram_write },
+	[IT87_BACKEND_ECIO] = { "ecio", it87_ecio_read, it87_ecio_write },
+};
+
+/* Backend accesses, timed for the trace events while they are enabled */
+static int it87_bus_read(struct it87_data *data, u16 reg)
 {
-	u8 ctrl;
+	u64 start;
+	int val;
+
+	if (!trace_it87_reg_read_enabled())
+		return data->bus_read(data, reg);
+
+	start = ktime_get_ns();
+	val = data->bus_read(data, reg);
+	trace_it87_reg_read(data->addr, data->backend, reg, val,
+			    ktime_get_ns() - start);
+	return val;
+}
+
+static void it87_bus_write(struct it87_data *data, u16 reg, u8 value)
+{
+	u64 start;
+
+	if (!trace_it87_reg_write_enabled()) {
+		data->bus_write(data, reg, value);
+		return;
+	}
+
+	start = ktime_get_ns();
+	data->bus_write(data, reg, value);
+	trace_it87_reg_write(data->addr, data->backend, reg, value,
+			     ktime_get_ns() - start);
+}
+
+static void it87_set_backend(struct it87_data *data, enum it87_backend_id id)
+{
+	data->backend = id;
+	data->bus_read = it87_backends[id].read;
+	data->bus_write = it87_backends[id].write;
+	data->read = it87_bus_read;
+	data->write = it87_bus_write;
+}
+
+#define IT87_BENCH_ROUNDS	8
+#define IT87_BENCH_REGS		(2 + 2 * 8)
+#define IT87_BENCH_GAIN		25	/* % faster for port I/O to be used */
+
+/*
+ * Read a fixed set of registers which don't change by themselves (chip
+ * id, configuration and voltage limits) through backend id, the way a
+ * refresh would. Returns the best time per read in ns; the values read
+ * are stored in val.
+ * Must be called with SMBus accesses disabled, during initialization.
+ */
+static u32 it87_bench_backend(struct it87_data *data,
+			      enum it87_backend_id id, u8 *val)
+{
+	int (*read)(struct it87_data *, u16) = it87_backends[id].read;
+	u16 regs[IT87_BENCH_REGS];
+	u64 best = U64_MAX;
+	int round, i;
+
+	regs[0] = IT87_REG_CONFIG;
+	regs[1] = IT87_REG_CHIPID;
+	for (i = 0; i < 8; i++) {
+		regs[2 + 2 * i] = IT87_REG_VIN_MAX(i);
+		regs[3 + 2 * i] = IT87_REG_VIN_MIN(i);
+	}
+
+	it87_set_backend(data, id);
+	for (round = 0; round < IT87_BENCH_ROUNDS; round++) {
+		u64 start;
+
+		it87_bank_begin(data);
+		if (id == IT87_BACKEND_BRIDGE)
+			it87_bridge_begin(data);
+		start = ktime_get_ns();
+		for (i = 0; i < IT87_BENCH_REGS; i++)
+			val[i] = read(data, regs[i]);
+		best = min(best, ktime_get_ns() - start);
+		it87_bridge_end(data);
+		it87_bank_end(data);
+	}
+
+	return div_u64(best, IT87_BENCH_REGS) ? : 1;
+}
+
+/*
+ * Boards with MMIO usually also decode the registers in the conventional
+ * I/O window. Time both, and switch to port I/O if it is faster and reads
+ * the same values. The hybrid backends already use port I/O below H2RAM,
+ * so there is nothing to choose for them.
+ */
+static void it87_select_backend(struct device *dev)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	enum it87_backend_id id = data->backend;
+	enum it87_backend_id alt;
+	u8 ref[IT87_BENCH_REGS], val[IT87_BENCH_REGS];
+
+	if (!bench_backend || !data->addr ||
+	    (id != IT87_BACKEND_MMIO && id != IT87_BACKEND_BRIDGE))
+		return;
+
+	alt = has_bank_sel(data) ? IT87_BACKEND_BANKED : IT87_BACKEND_IO;
+	data->backend_ns[id] = it87_bench_backend(data, id, ref);
+	data->backend_ns[alt] = it87_bench_backend(data, alt, val);
+
+	if (memcmp(ref, val, sizeof(ref))) {
+		dev_info(dev, "%s and %s access disagree, using %s\n",
+			 it87_backends[id].name, it87_backends[alt].name,
+			 it87_backends[id].name);
+		data->backend_ns[alt] = 0;
+	} else if ((u64)data->backend_ns[alt] * 100 <
+		   (u64)data->backend_ns[id] * (100 - IT87_BENCH_GAIN)) {
+		id = alt;
+		/* The bridge window is not needed any more */
+		data->mmio_bridge = false;
+	}
+	it87_set_backend(data, id);
+
+	dev_dbg(dev, "Using %s access, %u ns per read\n",
+		it87_backends[id].name, data->backend_ns[id]);
+}
+
+/* Derive the temperature mapping and duty cycle from pwm_ctrl */
+static void it87_decode_pwm_ctrl(struct it87_data *data, int nr)
+{
+	u8 ctrl = data->pwm_ctrl[nr];
 
-	ctrl = data->read(data, data->REG_PWM[nr]);
-	data->pwm_ctrl[nr] = ctrl;
 	if (has_newer_autopwm(data)) {
 		data->pwm_temp_map[nr] = temp_map_from_reg(data, ctrl);
-		data->pwm_duty[nr] = data->read(data, IT87_REG_PWM_DUTY[nr]);
 	} else {
 		if (ctrl & 0x80)	/* Automatic mode */
 			data->pwm_temp_map[nr] = temp_map_from_reg(data, ctrl);
 		else				/* Manual mode */
 			data->pwm_duty[nr] = ctrl & 0x7f;
 	}
-
-	if (has_old_autopwm(data)) {
-		int i;
-
-		for (i = 0; i < 5 ; i++)
-			data->auto_temp[nr][i] = data->read(data,
-						IT87_REG_AUTO_TEMP(nr, i));
-		for (i = 0; i < 3 ; i++)
-			data->auto_pwm[nr][i] = data->read(data,
-						IT87_REG_AUTO_PWM(nr, i));
-	} else if (has_newer_autopwm(data)) {
-		int i;
-
-		/*
-		 * 0: temperature hysteresis (base + 5)
-		 * 1: fan off temperature (base + 0)
-		 * 2: fan start temperature (base + 1)
-		 * 3: fan max temperature (base + 2)
-		 */
-		data->auto_temp[nr][0] =
-			data->read(data, IT87_REG_AUTO_TEMP(nr, 5));
-
-		for (i = 0; i < 3 ; i++)
-			data->auto_temp[nr][i + 1] =
-				data->read(data, IT87_REG_AUTO_TEMP(nr, i));
-		/*
-		 * 0: start pwm value (base + 3)
-		 * 1: pwm slope (base + 4, 1/8th pwm)
-		 */
-		data->auto_pwm[nr][0] =
-			data->read(data, IT87_REG_AUTO_TEMP(nr, 3));
-		data->auto_pwm[nr][1] =
-			data->read(data, IT87_REG_AUTO_TEMP(nr, 4));
-	}
 }
 
 static int it87_lock(struct it87_data *data)
@@ -2438,315 +3094,989 @@ static int it87_lock(struct it87_data *data)
 	int err;
 
 	mutex_lock(&data->update_lock);
+	if (it87_ec_degraded(data)) {
+		mutex_unlock(&data->update_lock);
+		return -EIO;
+	}
 	err = smbus_disable(data);
-	if (err)
+	if (err) {
 		mutex_unlock(&data->update_lock);
-	return err;
+		return err;
+	}
+	it87_bank_begin(data);
+	it87_bridge_begin(data);
+	return 0;
 }
 
 static void it87_unlock(struct it87_data *data)
 {
+	it87_bridge_end(data);
+	it87_bank_end(data);
 	smbus_enable(data);
 	mutex_unlock(&data->update_lock);
 }
 
-static struct it87_data *it87_update_device(struct device *dev)
+/*
+ * Stores change cached values inside a data->seq write section, like
+ * refreshes publish them, so that lockless readers see all of a change or
+ * none of it. The section can't sleep, so registers are accessed outside.
+ * Must be called with data->update_lock held.
+ */
+static void it87_cache_begin(struct it87_data *data)
+{
+	write_seqcount_begin(&data->seq);
+}
+
+static void it87_cache_end(struct it87_data *data)
+{
+	write_seqcount_end(&data->seq);
+}
+
+static int it87_update_pwm_ctrl(struct it87_data *data, int nr)
+{
+	int ctrl, duty = 0;
+
+	ctrl = data->read(data, data->REG_PWM[nr]);
+	if (ctrl < 0)
+		return ctrl;
+	if (has_newer_autopwm(data)) {
+		duty = data->read(data, IT87_REG_PWM_DUTY[nr]);
+		if (duty < 0)
+			return duty;
+	}
+
+	it87_cache_begin(data);
+	data->pwm_ctrl[nr] = ctrl;
+	if (has_newer_autopwm(data))
+		data->pwm_duty[nr] = duty;
+	it87_decode_pwm_ctrl(data, nr);
+	it87_cache_end(data);
+	return 0;
+}
+
+/*
+ * Refresh plans
+ *
+ * The registers read by each cache class are compiled once at probe time
+ * into a flat table of (register, cached field) entries, sorted by register
+ * and thereby by bank. Refreshing a class then only needs to walk its table,
+ * without re-evaluating the chip features for every register.
+ */
+#define IT87_PLAN_MAX	128
+
+struct it87_plan_builder {
+	struct it87_plan_entry *entries;
+	unsigned int count;
+};
+
+static void it87_plan_add(struct it87_plan_builder *b, u16 reg, void *dst,
+			  u8 size, u8 shift)
+{
+	struct it87_plan_entry *e;
+
+	if (WARN_ON(b->count >= IT87_PLAN_MAX))
+		return;
+
+	e = &b->entries[b->count++];
+	e->dst = dst;
+	e->reg = reg;
+	e->size = size;
+	e->shift = shift;
+}
+
+/* Register holds the low byte (or all) of field */
+#define it87_plan_field(b, reg, field) \
+	it87_plan_add(b, reg, &(field), sizeof(field), 0)
+/* Register holds the high byte of field */
+#define it87_plan_field_hi(b, reg, field) \
+	it87_plan_add(b, reg, &(field), sizeof(field), 8)
+
+static void it87_plan_in(struct it87_data *data, struct it87_plan_builder *b)
 {
-	struct it87_data *data = dev_get_drvdata(dev);
-	struct it87_data *ret = data;
-	int err;
 	int i;
 
-	mutex_lock(&data->update_lock);
+	for (i = 0; i < NUM_VIN; i++) {
+		if (!(data->has_in & BIT(i)))
+			continue;
+		it87_plan_field(b, IT87_REG_VIN[i], data->in[i][0]);
+	}
+}
 
-	if (time_after(jiffies, data->last_updated + HZ + HZ / 2) ||
-		       !data->valid) {
-		err = smbus_disable(data);
-		if (err) {
-			ret = ERR_PTR(err);
-			goto unlock;
-		}
-		if (update_vbat) {
+static void it87_plan_fan(struct it87_data *data, struct it87_plan_builder *b)
+{
+	int i;
+
+	for (i = 0; i < NUM_FAN; i++) {
+		/* Skip disabled fans */
+		if (!(data->has_fan & BIT(i)))
+			continue;
+
+		it87_plan_field(b, data->REG_FAN[i], data->fan[i][0]);
+		/* Add high byte if in 16-bit mode */
+		if (has_16bit_fans(data))
+			it87_plan_field_hi(b, data->REG_FANX[i],
+					   data->fan[i][0]);
+	}
+
+	/* Newer chips don't have clock dividers */
+	if ((data->has_fan & 0x07) && !has_16bit_fans(data))
+		it87_plan_field(b, IT87_REG_FAN_DIV, data->fan_div_reg);
+}
+
+static void it87_plan_temp(struct it87_data *data, struct it87_plan_builder *b)
+{
+	int i;
+
+	for (i = 0; i < NUM_TEMP; i++) {
+		if (!(data->has_temp & BIT(i)))
+			continue;
+		it87_plan_field(b, IT87_REG_TEMP(i), data->temp[i][0]);
+	}
+}
+
+static void it87_plan_pwm(struct it87_data *data, struct it87_plan_builder *b)
+{
+	int i;
+
+	it87_plan_field(b, IT87_REG_FAN_MAIN_CTRL, data->fan_main_ctrl);
+	it87_plan_field(b, IT87_REG_FAN_CTL, data->fan_ctl);
+	for (i = 0; i < NUM_PWM; i++) {
+		if (!(data->has_pwm & BIT(i)))
+			continue;
+		it87_plan_field(b, data->REG_PWM[i], data->pwm_ctrl[i]);
+		if (has_newer_autopwm(data))
+			it87_plan_field(b, IT87_REG_PWM_DUTY[i],
+					data->pwm_duty[i]);
+	}
+
+	/* Temperature sensor types, also used for the pwm2 frequency */
+	it87_plan_field(b, IT87_REG_TEMP_ENABLE, data->sensor);
+	it87_plan_field(b, IT87_REG_TEMP_EXTRA, data->extra);
+}
+
+static void it87_plan_alarm(struct it87_data *data,
+			    struct it87_plan_builder *b)
+{
+	it87_plan_add(b, IT87_REG_ALARM1, &data->alarms,
+		      sizeof(data->alarms), 0);
+	it87_plan_add(b, IT87_REG_ALARM2, &data->alarms,
+		      sizeof(data->alarms), 8);
+	it87_plan_add(b, IT87_REG_ALARM3, &data->alarms,
+		      sizeof(data->alarms), 16);
+	it87_plan_field(b, IT87_REG_BEEP_ENABLE, data->beeps);
+}
+
+static void it87_plan_vid(struct it87_data *data, struct it87_plan_builder *b)
+{
+	/*
+	 * The IT8705F does not have VID capability.
+	 * The IT8718F and later don't use IT87_REG_VID for the
+	 * same purpose.
+	 */
+	if (data->type == it8712 || data->type == it8716)
+		it87_plan_field(b, IT87_REG_VID, data->vid);
+}
+
+/*
+ * Limit registers are only changed by this driver, so they are read once
+ * and then kept up to date by the store handlers.
+ */
+static void it87_plan_limit(struct it87_data *data,
+			    struct it87_plan_builder *b)
+{
+	int i, j;
+
+	for (i = 0; i < NUM_VIN_LIMIT; i++) {
+		if (!(data->has_in & BIT(i)))
+			continue;
+		it87_plan_field(b, IT87_REG_VIN_MIN(i), data->in[i][1]);
+		it87_plan_field(b, IT87_REG_VIN_MAX(i), data->in[i][2]);
+	}
+
+	for (i = 0; i < NUM_FAN; i++) {
+		if (!(data->has_fan & BIT(i)))
+			continue;
+		it87_plan_field(b, data->REG_FAN_MIN[i], data->fan[i][1]);
+		if (has_16bit_fans(data))
+			it87_plan_field_hi(b, data->REG_FANX_MIN[i],
+					   data->fan[i][1]);
+	}
+
+	for (i = 0; i < data->num_temp_limit; i++) {
+		if (!(data->has_temp & BIT(i)))
+			continue;
+		if (i < data->num_temp_offset)
+			it87_plan_field(b, data->REG_TEMP_OFFSET[i],
+					data->temp[i][3]);
+		it87_plan_field(b, data->REG_TEMP_LOW[i], data->temp[i][1]);
+		it87_plan_field(b, data->REG_TEMP_HIGH[i], data->temp[i][2]);
+	}
+
+	for (i = 0; i < NUM_AUTO_PWM; i++) {
+		if (!(data->has_pwm & BIT(i)))
+			continue;
+
+		if (has_old_autopwm(data)) {
+			for (j = 0; j < 5 ; j++)
+				it87_plan_field(b, IT87_REG_AUTO_TEMP(i, j),
+						data->auto_temp[i][j]);
+			for (j = 0; j < 3 ; j++)
+				it87_plan_field(b, IT87_REG_AUTO_PWM(i, j),
+						data->auto_pwm[i][j]);
+		} else if (has_newer_autopwm(data)) {
 			/*
-			 * Cleared after each update, so reenable.  Value
-			 * returned by this read will be previous value
+			 * 0: temperature hysteresis (base + 5)
+			 * 1: fan off temperature (base + 0)
+			 * 2: fan start temperature (base + 1)
+			 * 3: fan max temperature (base + 2)
 			 */
-			data->write(data, IT87_REG_CONFIG,
-				    data->read(data, IT87_REG_CONFIG) | 0x40);
+			it87_plan_field(b, IT87_REG_AUTO_TEMP(i, 5),
+					data->auto_temp[i][0]);
+			for (j = 0; j < 3 ; j++)
+				it87_plan_field(b, IT87_REG_AUTO_TEMP(i, j),
+						data->auto_temp[i][j + 1]);
+			/*
+			 * 0: start pwm value (base + 3)
+			 * 1: pwm slope (base + 4, 1/8th pwm)
+			 */
+			it87_plan_field(b, IT87_REG_AUTO_TEMP(i, 3),
+					data->auto_pwm[i][0]);
+			it87_plan_field(b, IT87_REG_AUTO_TEMP(i, 4),
+					data->auto_pwm[i][1]);
+		}
+	}
+}
+
+static void (* const it87_plan_class[IT87_NUM_CACHE])
+		(struct it87_data *, struct it87_plan_builder *) = {
+	[IT87_CACHE_IN] = it87_plan_in,
+	[IT87_CACHE_FAN] = it87_plan_fan,
+	[IT87_CACHE_TEMP] = it87_plan_temp,
+	[IT87_CACHE_PWM] = it87_plan_pwm,
+	[IT87_CACHE_ALARM] = it87_plan_alarm,
+	[IT87_CACHE_VID] = it87_plan_vid,
+	[IT87_CACHE_LIMIT] = it87_plan_limit,
+};
+
+/* Decode the cached fields which don't map directly to a register */
+static void it87_fixup_fan(struct it87_data *data)
+{
+	if ((data->has_fan & 0x07) && !has_16bit_fans(data)) {
+		data->fan_div[0] = data->fan_div_reg & 0x07;
+		data->fan_div[1] = (data->fan_div_reg >> 3) & 0x07;
+		data->fan_div[2] = (data->fan_div_reg & 0x40) ? 3 : 1;
+	}
+}
+
+static void it87_fixup_pwm(struct it87_data *data)
+{
+	int i;
+
+	for (i = 0; i < NUM_PWM; i++) {
+		if (!(data->has_pwm & BIT(i)))
+			continue;
+		it87_decode_pwm_ctrl(data, i);
+	}
+}
+
+static void it87_fixup_vid(struct it87_data *data)
+{
+	/*
+	 * The older IT8712F revisions had only 5 VID pins,
+	 * but we assume it is always safe to read 6 bits.
+	 */
+	data->vid &= 0x3f;
+}
+
+static void (* const it87_plan_fixup[IT87_NUM_CACHE])(struct it87_data *) = {
+	[IT87_CACHE_FAN] = it87_fixup_fan,
+	[IT87_CACHE_PWM] = it87_fixup_pwm,
+	[IT87_CACHE_VID] = it87_fixup_vid,
+};
+
+/* Return true if reg is accessed through the memory mapped window */
+static bool it87_reg_is_mmio(const struct it87_data *data, u16 reg)
+{
+	if (!data->mmio)
+		return false;
+	if (data->bus_read == it87_h2ram_read)
+		return reg >= H2RAM_LOW_BOUND && reg <= H2RAM_HI_BOUND;
+	return data->bus_read == it87_mmio_read ||
+	       data->bus_read == it87_bridge_read;
+}
+
+static int it87_plan_cmp(const void *a, const void *b)
+{
+	const struct it87_plan_entry *ea = a, *eb = b;
+
+	if (ea->reg != eb->reg)
+		return ea->reg - eb->reg;
+	if (ea->dst != eb->dst)
+		return ea->dst < eb->dst ? -1 : 1;
+	return ea->shift - eb->shift;
+}
+
+static void it87_dump_plan(struct device *dev, int nr)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	const struct it87_plan *plan = &data->plan[nr];
+	unsigned int i;
+
+	dev_dbg(dev, "Refresh plan '%s': %u registers\n",
+		it87_cache_names[nr], plan->count);
+	if (plan->mmio_lo <= plan->mmio_hi)
+		dev_dbg(dev, "  MMIO snapshot 0x%03x-0x%03x\n",
+			plan->mmio_lo, plan->mmio_hi);
+	for (i = 0; i < plan->count; i++) {
+		const struct it87_plan_entry *e = &plan->entries[i];
+
+		dev_dbg(dev, "  0x%03x -> offset %td size %u shift %u\n",
+			e->reg, (u8 *)e->dst - (u8 *)data, e->size, e->shift);
+	}
+}
+
+/* Must be called once the has_* bitfields are final */
+static int it87_build_plan(struct device *dev)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	struct it87_plan_builder b;
+	unsigned int i, j, n;
+	int err = 0;
+
+	b.entries = kcalloc(IT87_PLAN_MAX, sizeof(*b.entries), GFP_KERNEL);
+	if (!b.entries)
+		return -ENOMEM;
+
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		b.count = 0;
+		it87_plan_class[i](data, &b);
+		sort(b.entries, b.count, sizeof(*b.entries), it87_plan_cmp,
+		     NULL);
+
+		/* Drop duplicate entries */
+		data->plan[i].mmio_lo = 0xffff;
+		data->plan[i].mmio_hi = 0;
+		for (j = 0, n = 0; j < b.count; j++) {
+			u16 reg = b.entries[j].reg;
+
+			if (n && !it87_plan_cmp(&b.entries[n - 1],
+						&b.entries[j]))
+				continue;
+			b.entries[n++] = b.entries[j];
+
+			if (!it87_reg_is_mmio(data, reg))
+				continue;
+			data->plan[i].mmio_lo = min(data->plan[i].mmio_lo, reg);
+			data->plan[i].mmio_hi = max(data->plan[i].mmio_hi, reg);
+		}
+
+		if (n) {
+			data->plan[i].entries = devm_kmemdup(dev, b.entries,
+						n * sizeof(*b.entries),
+						GFP_KERNEL);
+			data->plan[i].vals = devm_kcalloc(dev, n,
+						sizeof(*data->plan[i].vals),
+						GFP_KERNEL);
+			if (!data->plan[i].entries || !data->plan[i].vals) {
+				err = -ENOMEM;
+				break;
+			}
+		}
+		data->plan[i].count = n;
+		it87_dump_plan(dev, i);
+	}
+
+	kfree(b.entries);
+	return err;
+}
+
+/*
+ * Refreshes run in two phases: the registers of all stale classes are read
+ * into the plans' value buffers first, which is the slow part, and are then
+ * published into the cached fields in one go, inside the data->seq write
+ * section.
+ */
+
+/*
+ * Must be called with data->update_lock held and SMBus accesses disabled.
+ * Entries sharing a register only cause a single read.
+ * Returns the number of registers read from the chip, not counting those
+ * found in the shadow buffer, or -EIO if one of them could not be read, in
+ * which case the plan's values must not be published.
+ */
+static int it87_read_plan(struct it87_data *data,
+				   const struct it87_plan *plan)
+{
+	bool direct = data->bus_read == _it87_io_read;
+	bool banked = data->bus_read == it87_io_read && data->bank_session;
+	bool traced = trace_it87_reg_read_enabled();
+	unsigned int regs = 0;
+	u64 start = 0;
+	int reg = -1;
+	int val = 0;
+	unsigned int i;
+
+	for (i = 0; i < plan->count; i++) {
+		if (plan->entries[i].reg != reg) {
+			reg = plan->entries[i].reg;
+			if (data->shadow_valid && reg >= data->shadow_lo &&
+				   reg <= data->shadow_hi) {
+				val = data->shadow[reg];
+			} else if (direct || banked) {
+				regs++;
+				if (traced)
+					start = ktime_get_ns();
+				if (banked) {
+					it87_bank_select(data, reg >> 8);
+					val = _it87_io_read(data, reg & 0xff);
+				} else {
+					val = _it87_io_read(data, reg);
+				}
+				if (traced)
+					trace_it87_reg_read(data->addr,
+							    data->backend, reg,
+							    val,
+							    ktime_get_ns() - start);
+			} else {
+				regs++;
+				val = it87_bus_read(data, reg);
+				if (val < 0)
+					return val;
+			}
+		}
+		plan->vals[i] = val;
+	}
+	return regs;
+}
+
+/* Must be called with data->update_lock held */
+static void it87_store_plan(const struct it87_plan *plan)
+{
+	const struct it87_plan_entry *e;
+	unsigned int i;
+
+	for (i = 0; i < plan->count; i++) {
+		u32 val = plan->vals[i];
+
+		e = &plan->entries[i];
+		switch (e->size) {
+		case 1:
+			*(u8 *)e->dst = val;
+			break;
+		case 2:
+			*(u16 *)e->dst = (*(u16 *)e->dst &
+					  ~(0xff << e->shift)) |
+					 (val << e->shift);
+			break;
+		case 4:
+			*(u32 *)e->dst = (*(u32 *)e->dst &
+					  ~(0xffU << e->shift)) |
+					 (val << e->shift);
+			break;
+		}
+	}
+}
+
+/*
+ * MMIO snapshots
+ *
+ * On memory mapped chips, the registers read by the classes being refreshed
+ * are copied into data->shadow in one pass before the plans are run against
+ * that copy. This gives a consistent snapshot of all channels and saves an
+ * indirect call per register. Only the registers in the plans are copied,
+ * one byte at a time, as the LPC window may not cope with wider accesses.
+ * Must be called with data->update_lock held.
+ */
+static unsigned int it87_shadow_copy(struct it87_data *data,
+				     const struct it87_plan *plan)
+{
+	unsigned int i, n = 0;
+	int reg = -1;
+
+	for (i = 0; i < plan->count; i++) {
+		if (plan->entries[i].reg == reg)
+			continue;
+		reg = plan->entries[i].reg;
+		if (!it87_reg_is_mmio(data, reg))
+			continue;
+		data->shadow[reg] = readb(data->mmio + reg);
+		n++;
+	}
+	return n;
+}
+
+/* Returns the number of registers copied */
+static unsigned int it87_shadow_begin(struct it87_data *data,
+				      unsigned int classes)
+{
+	bool traced = trace_it87_burst_read_enabled();
+	u16 lo = 0xffff, hi = 0;
+	unsigned int n = 0;
+	u64 start = 0;
+	int err = 0;
+	int i;
+
+	if (!data->shadow)
+		return 0;
+
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		if (!(classes & BIT(i)))
+			continue;
+		lo = min(lo, data->plan[i].mmio_lo);
+		hi = max(hi, data->plan[i].mmio_hi);
+	}
+	if (lo > hi)
+		return 0;
+
+	if (traced)
+		start = ktime_get_ns();
+	if (data->bus_read != it87_mmio_read)
+		err = it87_bridge_begin(data);
+	for (i = 0; !err && i < IT87_NUM_CACHE; i++)
+		if (classes & BIT(i))
+			n += it87_shadow_copy(data, &data->plan[i]);
+	if (data->bus_read != it87_mmio_read)
+		it87_bridge_end(data);
+	if (traced)
+		trace_it87_burst_read(data->addr, data->backend, lo, n, err,
+				      ktime_get_ns() - start);
+
+	/* On failure, fall back to register by register reads */
+	if (err)
+		return 0;
+	data->shadow_lo = lo;
+	data->shadow_hi = hi;
+	data->shadow_valid = true;
+	return n;
+}
+
+static void it87_shadow_end(struct it87_data *data)
+{
+	data->shadow_valid = false;
+}
+
+/* Returns the number of registers read, or a negative error code */
+static int it87_refresh_class(struct it87_data *data, int nr)
+{
+	if (nr == IT87_CACHE_IN && update_vbat) {
+		int config = data->read(data, IT87_REG_CONFIG);
+
+		if (config < 0)
+			return config;
+		/*
+		 * Cleared after each update, so reenable.  Value
+		 * returned by this read will be previous value
+		 */
+		data->write(data, IT87_REG_CONFIG, config | 0x40);
+	}
+
+	return it87_read_plan(data, &data->plan[nr]);
+}
+
+static void it87_publish_class(struct it87_data *data, int nr)
+{
+	it87_store_plan(&data->plan[nr]);
+	if (it87_plan_fixup[nr])
+		it87_plan_fixup[nr](data);
+	WRITE_ONCE(data->cache[nr].last_updated, jiffies);
+	WRITE_ONCE(data->cache[nr].valid, true);
+}
+
+/* Must be called with update_lock held */
+static void it87_invalidate(struct it87_data *data, unsigned int classes)
+{
+	int i;
+
+	for (i = 0; i < IT87_NUM_CACHE; i++)
+		if (classes & BIT(i))
+			WRITE_ONCE(data->cache[i].valid, false);
+}
+
+/*
+ * Return the classes among the requested ones which need a refresh, or
+ * will need one within the next ahead jiffies.
+ */
+static unsigned int it87_stale_classes(struct it87_data *data,
+				       unsigned int classes,
+				       unsigned long ahead)
+{
+	unsigned long now = jiffies + ahead;
+	unsigned int stale = 0;
+	int i;
+
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		struct it87_cache *cache = &data->cache[i];
+		unsigned long last_updated = READ_ONCE(cache->last_updated);
+		unsigned long interval;
+
+		if (!(classes & BIT(i)))
+			continue;
+		if (!READ_ONCE(cache->valid)) {
+			stale |= BIT(i);
+			continue;
+		}
+
+		if (i == IT87_CACHE_LIMIT) {
+			if (!limit_refresh)
+				continue;
+			interval = min_t(unsigned long, limit_refresh,
+					 MAX_JIFFY_OFFSET / HZ) * HZ;
+		} else {
+			interval = msecs_to_jiffies(
+					READ_ONCE(data->update_interval[i]));
+		}
+		if (time_after(now, last_updated + interval))
+			stale |= BIT(i);
+	}
+	return stale;
+}
+
+/* Alarm bits of fan1 .. fan6 */
+static const u8 it87_fan_alarm_bit[] = { 0, 1, 2, 3, 6, 7 };
+
+/*
+ * Wake up anybody polling an alarm attribute whose bit changed.
+ * Must be called with data->update_lock held.
+ */
+static void it87_notify_alarms(struct it87_data *data, u32 changed)
+{
+	struct device *dev = data->hwmon_dev;
+	int i;
+
+	if (!dev || !changed)
+		return;
+
+	/* hwmon_notify_event() also sends a uevent, one per channel is enough */
+	sysfs_notify(&dev->kobj, NULL, "alarms");
+	for (i = 0; i < NUM_VIN_LIMIT; i++)
+		if ((changed & BIT(8 + i)) && (data->has_in & BIT(i)))
+			hwmon_notify_event(dev, hwmon_in, hwmon_in_alarm, i);
+	for (i = 0; i < NUM_TEMP; i++)
+		if ((changed & BIT(16 + i)) && (data->has_temp & BIT(i)))
+			hwmon_notify_event(dev, hwmon_temp, hwmon_temp_alarm, i);
+	for (i = 0; i < NUM_FAN; i++)
+		if ((changed & BIT(it87_fan_alarm_bit[i])) &&
+		    (data->has_fan & BIT(i)))
+			hwmon_notify_event(dev, hwmon_fan, hwmon_fan_alarm, i);
+	if (changed & BIT(4))
+		sysfs_notify(&dev->kobj, NULL, "intrusion0_alarm");
+}
+
+/*
+ * Refresh the given classes unconditionally.
+ * Classes with a register which failed to read, which only happens through
+ * the EC, keep their last good values, and the error is returned if one of
+ * them has none.
+ * Must be called with data->update_lock held.
+ */
+static int it87_refresh(struct it87_data *data, unsigned int classes)
+{
+	u32 alarms = data->alarms;
+	bool alarms_valid = data->cache[IT87_CACHE_ALARM].valid;
+	unsigned int failed = 0, regs = 0;
+	int ret = 0;
+	int err;
+	int i;
+
+	/* Before the window is switched away from the other chip */
+	if (it87_has_bridge(data) && !data->bridge_session)
+		it87_bridge_prefetch(data);
+
+	trace_it87_refresh_begin(data->addr, classes);
+	/* Keep the last good values rather than waiting on a wedged EC */
+	if (it87_ec_degraded(data)) {
+		for (i = 0; i < IT87_NUM_CACHE; i++)
+			if ((classes & BIT(i)) && !data->cache[i].valid)
+				ret = -EIO;
+		trace_it87_refresh_end(data->addr, classes, 0, ret);
+		return ret;
+	}
+
+	err = smbus_disable(data);
+	if (err) {
+		trace_it87_refresh_end(data->addr, classes, 0, err);
+		return err;
+	}
+
+	it87_bank_begin(data);
+	it87_bridge_begin(data);
+	regs = it87_shadow_begin(data, classes);
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		if (!(classes & BIT(i)))
+			continue;
+		err = it87_refresh_class(data, i);
+		if (err < 0) {
+			failed |= BIT(i);
+			if (!data->cache[i].valid)
+				ret = err;
+			continue;
 		}
-		for (i = 0; i < NUM_VIN; i++) {
-			if (!(data->has_in & BIT(i)))
-				continue;
-
-			data->in[i][0] = data->read(data, IT87_REG_VIN[i]);
+		regs += err;
+	}
+	it87_shadow_end(data);
+	it87_bridge_end(data);
+	it87_bank_end(data);
+	smbus_enable(data);
 
-			/* VBAT and AVCC don't have limit registers */
-			if (i >= NUM_VIN_LIMIT)
-				continue;
+	classes &= ~failed;
+	write_seqcount_begin(&data->seq);
+	for (i = 0; i < IT87_NUM_CACHE; i++)
+		if (classes & BIT(i))
+			it87_publish_class(data, i);
+	write_seqcount_end(&data->seq);
+	trace_it87_refresh_end(data->addr, classes | failed, regs, ret);
 
-			data->in[i][1] = data->read(data, IT87_REG_VIN_MIN(i));
-			data->in[i][2] = data->read(data, IT87_REG_VIN_MAX(i));
-		}
+	if ((classes & BIT(IT87_CACHE_ALARM)) && alarms_valid)
+		it87_notify_alarms(data, alarms ^ data->alarms);
+	return ret;
+}
 
-		for (i = 0; i < NUM_FAN; i++) {
-			/* Skip disabled fans */
-			if (!(data->has_fan & BIT(i)))
-				continue;
+/*
+ * Background sampler
+ *
+ * With sample_interval set, the first sensor read starts a worker which
+ * runs every sample_interval milliseconds and refreshes the classes which
+ * are about to expire, so that reads find fresh values and never wait for
+ * the chip. Once nothing has been read for IT87_SAMPLER_IDLE periods, it
+ * stops until the next read. Reads of alarm attributes only keep the alarms
+ * sampled, so that a poll() loop on them notices changes without paying for
+ * the other classes. Limits keep following limit_refresh.
+ */
+static void it87_sampler_work(struct work_struct *work)
+{
+	struct it87_data *data = container_of(to_delayed_work(work),
+					      struct it87_data, sampler);
+	unsigned long period = msecs_to_jiffies(sample_interval);
+	unsigned long idle = IT87_SAMPLER_IDLE * period;
+	unsigned int classes;
+
+	if (period &&
+	    time_before(jiffies, READ_ONCE(data->last_read) + idle)) {
+		classes = IT87_CACHE_ALL;
+	} else if (period &&
+		   time_before(jiffies,
+			       READ_ONCE(data->last_alarm_read) + idle)) {
+		classes = BIT(IT87_CACHE_ALARM);
+	} else {
+		WRITE_ONCE(data->sampling, false);
+		return;
+	}
 
-			data->fan[i][1] = data->read(data,
-					data->REG_FAN_MIN[i]);
-			data->fan[i][0] = data->read(data, data->REG_FAN[i]);
-			/* Add high byte if in 16-bit mode */
-			if (has_16bit_fans(data)) {
-				data->fan[i][0] |= data->read(data,
-						data->REG_FANX[i]) << 8;
-				data->fan[i][1] |= data->read(data,
-						data->REG_FANX_MIN[i]) << 8;
-			}
-		}
-		for (i = 0; i < NUM_TEMP; i++) {
-			if (!(data->has_temp & BIT(i)))
-				continue;
-			data->temp[i][0] =
-				data->read(data, IT87_REG_TEMP(i));
+	mutex_lock(&data->update_lock);
+	/* Refresh whatever would expire before the next run */
+	classes = it87_stale_classes(data, classes, period + period / 2);
+	if (classes)
+		it87_refresh(data, classes);
+	mutex_unlock(&data->update_lock);
 
-			if (i >= data->num_temp_limit)
-				continue;
+	queue_delayed_work(system_freezable_wq, &data->sampler, period);
+}
 
-			if (i < data->num_temp_offset)
-				data->temp[i][3] =
-				  data->read(data, data->REG_TEMP_OFFSET[i]);
+static void it87_sampler_kick(struct it87_data *data, unsigned int classes)
+{
+	if (classes == BIT(IT87_CACHE_ALARM))
+		WRITE_ONCE(data->last_alarm_read, jiffies);
+	else
+		WRITE_ONCE(data->last_read, jiffies);
+	if (!sample_interval || READ_ONCE(data->sampling))
+		return;
 
-			data->temp[i][1] =
-				data->read(data, data->REG_TEMP_LOW[i]);
-			data->temp[i][2] =
-				data->read(data, data->REG_TEMP_HIGH[i]);
-		}
+	WRITE_ONCE(data->sampling, true);
+	queue_delayed_work(system_freezable_wq, &data->sampler, 0);
+}
 
-		/* Newer chips don't have clock dividers */
-		if ((data->has_fan & 0x07) && !has_16bit_fans(data)) {
-			i = data->read(data, IT87_REG_FAN_DIV);
-			data->fan_div[0] = i & 0x07;
-			data->fan_div[1] = (i >> 3) & 0x07;
-			data->fan_div[2] = (i & 0x40) ? 3 : 1;
-		}
+static void it87_sampler_stop(void *arg)
+{
+	struct it87_data *data = arg;
 
-		data->alarms =
-			data->read(data, IT87_REG_ALARM1) |
-			(data->read(data, IT87_REG_ALARM2) << 8) |
-			(data->read(data, IT87_REG_ALARM3) << 16);
-		data->beeps = data->read(data, IT87_REG_BEEP_ENABLE);
+	cancel_delayed_work_sync(&data->sampler);
+}
 
-		data->fan_main_ctrl = data->read(data, IT87_REG_FAN_MAIN_CTRL);
-		data->fan_ctl = data->read(data, IT87_REG_FAN_CTL);
-		for (i = 0; i < NUM_PWM; i++) {
-			if (!(data->has_pwm & BIT(i)))
-				continue;
-			it87_update_pwm_ctrl(data, i);
-		}
+/* Stop notifying before the hwmon device goes away */
+static void it87_alarm_detach(void *arg)
+{
+	struct it87_data *data = arg;
 
-		data->sensor = data->read(data, IT87_REG_TEMP_ENABLE);
-		data->extra = data->read(data, IT87_REG_TEMP_EXTRA);
-		/*
-		 * The IT8705F does not have VID capability.
-		 * The IT8718F and later don't use IT87_REG_VID for the
-		 * same purpose.
-		 */
-		if (data->type == it8712 || data->type == it8716) {
-			data->vid = data->read(data, IT87_REG_VID);
-			/*
-			 * The older IT8712F revisions had only 5 VID pins,
-			 * but we assume it is always safe to read 6 bits.
-			 */
-			data->vid &= 0x3f;
-		}
-		data->last_updated = jiffies;
-		data->valid = true;
-		smbus_enable(data);
-	}
-unlock:
+	mutex_lock(&data->update_lock);
+	data->hwmon_dev = NULL;
 	mutex_unlock(&data->update_lock);
-	return ret;
 }
 
-static ssize_t show_in(struct device *dev, struct device_attribute *attr,
-		       char *buf)
+/*
+ * Stale while revalidate
+ *
+ * With max_staleness set, a read of an expired class returns the previous
+ * values right away, as long as they are at most max_staleness ms old, and
+ * leaves the refresh to a work item. Older values, or none at all, are
+ * still refreshed synchronously.
+ */
+static unsigned int it87_too_stale(struct it87_data *data, unsigned int stale)
 {
-	struct sensor_device_attribute_2 *sattr = to_sensor_dev_attr_2(attr);
-	struct it87_data *data = it87_update_device(dev);
-	int index = sattr->index;
-	int nr = sattr->nr;
+	unsigned long limit = msecs_to_jiffies(max_staleness);
+	unsigned int hard = 0;
+	int i;
 
-	if (IS_ERR(data))
-		return PTR_ERR(data);
+	if (!limit)
+		return stale;
+
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		struct it87_cache *cache = &data->cache[i];
 
-	return sprintf(buf, "%d\n", in_from_reg(data, nr, data->in[nr][index]));
+		if (!(stale & BIT(i)))
+			continue;
+		if (!READ_ONCE(cache->valid) ||
+		    time_after(jiffies, READ_ONCE(cache->last_updated) + limit))
+			hard |= BIT(i);
+	}
+	return hard;
 }
 
-static ssize_t set_in(struct device *dev, struct device_attribute *attr,
-		      const char *buf, size_t count)
+static void it87_revalidate_work(struct work_struct *work)
 {
-	struct sensor_device_attribute_2 *sattr = to_sensor_dev_attr_2(attr);
-	struct it87_data *data = dev_get_drvdata(dev);
-	int index = sattr->index;
-	int nr = sattr->nr;
-	unsigned long val;
-	int err;
-
-	if (kstrtoul(buf, 10, &val) < 0)
-		return -EINVAL;
+	struct it87_data *data = container_of(work, struct it87_data,
+					      revalidate_work);
+	unsigned int classes = atomic_xchg(&data->revalidate, 0);
 
-	err = it87_lock(data);
-	if (err)
-		return err;
+	mutex_lock(&data->update_lock);
+	/* Somebody may have been quicker */
+	classes = it87_stale_classes(data, classes, 0);
+	if (classes)
+		it87_refresh(data, classes);
+	mutex_unlock(&data->update_lock);
+}
 
-	data->in[nr][index] = in_to_reg(data, nr, val);
-	data->write(data, index == 1 ? IT87_REG_VIN_MIN(nr)
-				     : IT87_REG_VIN_MAX(nr),
-		    data->in[nr][index]);
-	it87_unlock(data);
-	return count;
+static void it87_revalidate(struct it87_data *data, unsigned int classes)
+{
+	atomic_or(classes, &data->revalidate);
+	queue_work(system_freezable_wq, &data->revalidate_work);
 }
 
-static SENSOR_DEVICE_ATTR_2(in0_input, S_IRUGO, show_in, NULL, 0, 0);
-static SENSOR_DEVICE_ATTR_2(in0_min, S_IRUGO | S_IWUSR, show_in, set_in, 0, 1);
-static SENSOR_DEVICE_ATTR_2(in0_max, S_IRUGO | S_IWUSR, show_in, set_in, 0, 2);
+static void it87_revalidate_stop(void *arg)
+{
+	struct it87_data *data = arg;
+
+	cancel_work_sync(&data->revalidate_work);
+}
 
-static SENSOR_DEVICE_ATTR_2(in1_input, S_IRUGO, show_in, NULL, 1, 0);
-static SENSOR_DEVICE_ATTR_2(in1_min, S_IRUGO | S_IWUSR, show_in, set_in, 1, 1);
-static SENSOR_DEVICE_ATTR_2(in1_max, S_IRUGO | S_IWUSR, show_in, set_in, 1, 2);
+/*
+ * Refresh the cached registers of the requested classes (a bitmask of
+ * BIT(IT87_CACHE_*)), if they are invalid or have expired. Classes which
+ * are not requested are left alone.
+ *
+ * When everything requested is fresh, which is the common case, this
+ * doesn't take update_lock, so readers don't queue up behind a slow
+ * refresh of some other class or a store.
+ */
+static struct it87_data *it87_update_device_class(struct device *dev,
+						  unsigned int classes)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	struct it87_data *ret = data;
+	unsigned int stale, seq;
+	int err;
 
-static SENSOR_DEVICE_ATTR_2(in2_input, S_IRUGO, show_in, NULL, 2, 0);
-static SENSOR_DEVICE_ATTR_2(in2_min, S_IRUGO | S_IWUSR, show_in, set_in, 2, 1);
-static SENSOR_DEVICE_ATTR_2(in2_max, S_IRUGO | S_IWUSR, show_in, set_in, 2, 2);
+	it87_sampler_kick(data, classes);
 
-static SENSOR_DEVICE_ATTR_2(in3_input, S_IRUGO, show_in, NULL, 3, 0);
-static SENSOR_DEVICE_ATTR_2(in3_min, S_IRUGO | S_IWUSR, show_in, set_in, 3, 1);
-static SENSOR_DEVICE_ATTR_2(in3_max, S_IRUGO | S_IWUSR, show_in, set_in, 3, 2);
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		stale = it87_stale_classes(data, classes, 0);
+	} while (read_seqcount_retry(&data->seq, seq));
+	if (!stale)
+		return data;
 
-static SENSOR_DEVICE_ATTR_2(in4_input, S_IRUGO, show_in, NULL, 4, 0);
-static SENSOR_DEVICE_ATTR_2(in4_min, S_IRUGO | S_IWUSR, show_in, set_in, 4, 1);
-static SENSOR_DEVICE_ATTR_2(in4_max, S_IRUGO | S_IWUSR, show_in, set_in, 4, 2);
+	if (max_staleness) {
+		unsigned int hard = it87_too_stale(data, stale);
 
-static SENSOR_DEVICE_ATTR_2(in5_input, S_IRUGO, show_in, NULL, 5, 0);
-static SENSOR_DEVICE_ATTR_2(in5_min, S_IRUGO | S_IWUSR, show_in, set_in, 5, 1);
-static SENSOR_DEVICE_ATTR_2(in5_max, S_IRUGO | S_IWUSR, show_in, set_in, 5, 2);
+		if (stale & ~hard)
+			it87_revalidate(data, stale & ~hard);
+		if (!hard)
+			return data;
+	}
 
-static SENSOR_DEVICE_ATTR_2(in6_input, S_IRUGO, show_in, NULL, 6, 0);
-static SENSOR_DEVICE_ATTR_2(in6_min, S_IRUGO | S_IWUSR, show_in, set_in, 6, 1);
-static SENSOR_DEVICE_ATTR_2(in6_max, S_IRUGO | S_IWUSR, show_in, set_in, 6, 2);
+	mutex_lock(&data->update_lock);
 
-static SENSOR_DEVICE_ATTR_2(in7_input, S_IRUGO, show_in, NULL, 7, 0);
-static SENSOR_DEVICE_ATTR_2(in7_min, S_IRUGO | S_IWUSR, show_in, set_in, 7, 1);
-static SENSOR_DEVICE_ATTR_2(in7_max, S_IRUGO | S_IWUSR, show_in, set_in, 7, 2);
+	/* Somebody else may have done the work meanwhile */
+	stale = it87_stale_classes(data, classes, 0);
 
-static SENSOR_DEVICE_ATTR_2(in8_input, S_IRUGO, show_in, NULL, 8, 0);
-static SENSOR_DEVICE_ATTR_2(in9_input, S_IRUGO, show_in, NULL, 9, 0);
-static SENSOR_DEVICE_ATTR_2(in10_input, S_IRUGO, show_in, NULL, 10, 0);
-static SENSOR_DEVICE_ATTR_2(in11_input, S_IRUGO, show_in, NULL, 11, 0);
-static SENSOR_DEVICE_ATTR_2(in12_input, S_IRUGO, show_in, NULL, 12, 0);
+	if (stale) {
+		err = it87_refresh(data, stale);
+		if (err)
+			ret = ERR_PTR(err);
+	}
+	mutex_unlock(&data->update_lock);
+	return ret;
+}
 
-/* Up to 6 temperatures */
-static ssize_t show_temp(struct device *dev, struct device_attribute *attr,
-			 char *buf)
+static struct it87_data *it87_update_device(struct device *dev)
 {
-	struct sensor_device_attribute_2 *sattr = to_sensor_dev_attr_2(attr);
-	int nr = sattr->nr;
-	int index = sattr->index;
-	struct it87_data *data = it87_update_device(dev);
+	return it87_update_device_class(dev, IT87_CACHE_ALL);
+}
 
-	if (IS_ERR(data))
-		return PTR_ERR(data);
+/*
+ * Make sure pwm_ctrl[nr] and pwm_duty[nr] are current before changing them.
+ * The store handlers keep the cached values coherent, so the registers only
+ * need to be read again once the PWM class has expired.
+ * Must be called with data->update_lock held.
+ */
+static int it87_validate_pwm_ctrl(struct it87_data *data, int nr)
+{
+	if (it87_stale_classes(data, BIT(IT87_CACHE_PWM), 0))
+		return it87_update_pwm_ctrl(data, nr);
+	return 0;
+}
 
-	return sprintf(buf, "%d\n", TEMP_FROM_REG(data->temp[nr][index]));
+static int it87_in_read(struct it87_data *data, u32 attr, int nr, long *val)
+{
+	switch (attr) {
+	case hwmon_in_input:
+		*val = in_from_reg(data, nr, data->in[nr][0]);
+		break;
+	case hwmon_in_min:
+		*val = in_from_reg(data, nr, data->in[nr][1]);
+		break;
+	case hwmon_in_max:
+		*val = in_from_reg(data, nr, data->in[nr][2]);
+		break;
+	case hwmon_in_alarm:
+		*val = (data->alarms >> (8 + nr)) & 1;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	return 0;
 }
 
-static ssize_t set_temp(struct device *dev, struct device_attribute *attr,
-			const char *buf, size_t count)
+static int it87_in_write(struct device *dev, u32 attr, int nr, long val)
 {
-	struct sensor_device_attribute_2 *sattr = to_sensor_dev_attr_2(attr);
-	int nr = sattr->nr;
-	int index = sattr->index;
 	struct it87_data *data = dev_get_drvdata(dev);
-	long val;
-	u8 reg, regval;
+	int index;
 	int err;
 
-	if (kstrtol(buf, 10, &val) < 0)
-		return -EINVAL;
+	switch (attr) {
+	case hwmon_in_min:
+		index = 1;
+		break;
+	case hwmon_in_max:
+		index = 2;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
 
 	err = it87_lock(data);
 	if (err)
 		return err;
 
-	switch (index) {
-	default:
-	case 1:
-		reg = data->REG_TEMP_LOW[nr];
-		break;
-	case 2:
-		reg = data->REG_TEMP_HIGH[nr];
-		break;
-	case 3:
-		regval = data->read(data, IT87_REG_BEEP_ENABLE);
-		if (!(regval & 0x80)) {
-			regval |= 0x80;
-			data->write(data, IT87_REG_BEEP_ENABLE, regval);
-		}
-		data->valid = false;
-		reg = data->REG_TEMP_OFFSET[nr];
-		break;
-	}
-
-	data->temp[nr][index] = TEMP_TO_REG(val);
-	data->write(data, reg, data->temp[nr][index]);
+	it87_cache_begin(data);
+	data->in[nr][index] = in_to_reg(data, nr, val);
+	it87_cache_end(data);
+	data->write(data, index == 1 ? IT87_REG_VIN_MIN(nr)
+				     : IT87_REG_VIN_MAX(nr),
+		    data->in[nr][index]);
 	it87_unlock(data);
-	return count;
+	return 0;
 }
 
-static SENSOR_DEVICE_ATTR_2(temp1_input, S_IRUGO, show_temp, NULL, 0, 0);
-static SENSOR_DEVICE_ATTR_2(temp1_min, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    0, 1);
-static SENSOR_DEVICE_ATTR_2(temp1_max, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    0, 2);
-static SENSOR_DEVICE_ATTR_2(temp1_offset, S_IRUGO | S_IWUSR, show_temp,
-			    set_temp, 0, 3);
-static SENSOR_DEVICE_ATTR_2(temp2_input, S_IRUGO, show_temp, NULL, 1, 0);
-static SENSOR_DEVICE_ATTR_2(temp2_min, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    1, 1);
-static SENSOR_DEVICE_ATTR_2(temp2_max, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    1, 2);
-static SENSOR_DEVICE_ATTR_2(temp2_offset, S_IRUGO | S_IWUSR, show_temp,
-			    set_temp, 1, 3);
-static SENSOR_DEVICE_ATTR_2(temp3_input, S_IRUGO, show_temp, NULL, 2, 0);
-static SENSOR_DEVICE_ATTR_2(temp3_min, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    2, 1);
-static SENSOR_DEVICE_ATTR_2(temp3_max, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    2, 2);
-static SENSOR_DEVICE_ATTR_2(temp3_offset, S_IRUGO | S_IWUSR, show_temp,
-			    set_temp, 2, 3);
-static SENSOR_DEVICE_ATTR_2(temp4_input, S_IRUGO, show_temp, NULL, 3, 0);
-static SENSOR_DEVICE_ATTR_2(temp4_min, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    3, 1);
-static SENSOR_DEVICE_ATTR_2(temp4_max, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    3, 2);
-static SENSOR_DEVICE_ATTR_2(temp4_offset, S_IRUGO | S_IWUSR, show_temp,
-			    set_temp, 3, 3);
-static SENSOR_DEVICE_ATTR_2(temp5_input, S_IRUGO, show_temp, NULL, 4, 0);
-static SENSOR_DEVICE_ATTR_2(temp5_min, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    4, 1);
-static SENSOR_DEVICE_ATTR_2(temp5_max, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    4, 2);
-static SENSOR_DEVICE_ATTR_2(temp5_offset, S_IRUGO | S_IWUSR, show_temp,
-			    set_temp, 4, 3);
-static SENSOR_DEVICE_ATTR_2(temp6_input, S_IRUGO, show_temp, NULL, 5, 0);
-static SENSOR_DEVICE_ATTR_2(temp6_min, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    5, 1);
-static SENSOR_DEVICE_ATTR_2(temp6_max, S_IRUGO | S_IWUSR, show_temp, set_temp,
-			    5, 2);
-static SENSOR_DEVICE_ATTR_2(temp6_offset, S_IRUGO | S_IWUSR, show_temp,
-			    set_temp, 5, 3);
-
 static const u8 temp_types_8686[NUM_TEMP][9] = {
 	{ 0, 8, 8, 8, 8, 8, 8, 8, 7 },
 	{ 0, 6, 8, 8, 6, 0, 0, 0, 7 },
@@ -2758,7 +4088,7 @@ static const u8 temp_types_8686[NUM_TEMP][9] = {
 
 static int get_temp_type(struct it87_data *data, int index)
 {
-	u8 reg, extra;
+	int reg, extra;
 	int ttype, type = 0;
 
 	if (has_bank_sel(data)) {
@@ -2810,11 +4140,15 @@ static int get_temp_type(struct it87_data *data, int index)
 	if ((has_temp_peci(data, index)) || data->type == it8721 ||
 			data->type == it8720) {
 		extra = data->read(data, IT87_REG_IFSEL);
+		if (extra < 0)
+			return extra;
 		if ((extra & 0x70) == 0x40)
 			ttype = 5;
 	}
 
 	reg = data->read(data, IT87_REG_TEMP_ENABLE);
+	if (reg < 0)
+		return reg;
 
 	/* Per chip special detection */
 	switch (data->type) {
@@ -2830,6 +4164,8 @@ static int get_temp_type(struct it87_data *data, int index)
 		return type;
 
 	extra = data->read(data, IT87_REG_TEMP_EXTRA);
+	if (extra < 0)
+		return extra;
 
 	if ((has_temp_peci(data, index) && (reg >> 6 == index + 1)) ||
 			(has_temp_old_peci(data, index) && (extra & 0x80)))
@@ -2842,42 +4178,63 @@ static int get_temp_type(struct it87_data *data, int index)
 	return type;
 }
 
-static ssize_t show_temp_type(struct device *dev, struct device_attribute *attr,
-			      char *buf)
+/* get_temp_type() reads configuration registers, so it needs the lock */
+static int it87_read_temp_type(struct it87_data *data, int index)
 {
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = it87_update_device(dev);
-
-	if (IS_ERR(data))
-		return PTR_ERR(data);
+	int err, type;
 
-	return sprintf(buf, "%d\n", get_temp_type(data, sensor_attr->index));
+	err = it87_lock(data);
+	if (err)
+		return err;
+	type = get_temp_type(data, index);
+	it87_unlock(data);
+	return type;
 }
 
-static ssize_t set_temp_type(struct device *dev, struct device_attribute *attr,
-			     const char *buf, size_t count)
+static int it87_temp_read(struct it87_data *data, u32 attr, int nr, long *val)
 {
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	int nr = sensor_attr->index;
+	switch (attr) {
+	case hwmon_temp_input:
+		*val = TEMP_FROM_REG(data->temp[nr][0]);
+		break;
+	case hwmon_temp_min:
+		*val = TEMP_FROM_REG(data->temp[nr][1]);
+		break;
+	case hwmon_temp_max:
+		*val = TEMP_FROM_REG(data->temp[nr][2]);
+		break;
+	case hwmon_temp_offset:
+		*val = TEMP_FROM_REG(data->temp[nr][3]);
+		break;
+	case hwmon_temp_alarm:
+		*val = (data->alarms >> (16 + nr)) & 1;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	return 0;
+}
 
+static int it87_write_temp_type(struct device *dev, int nr, long val)
+{
 	struct it87_data *data = dev_get_drvdata(dev);
-	long val;
-	u8 reg, extra;
+	int reg, extra;
 	int err;
 
-	if (kstrtol(buf, 10, &val) < 0)
-		return -EINVAL;
-
 	err = it87_lock(data);
 	if (err)
 		return err;
 
 	reg = data->read(data, IT87_REG_TEMP_ENABLE);
+	extra = data->read(data, IT87_REG_TEMP_EXTRA);
+	if (reg < 0 || extra < 0) {
+		err = -EIO;
+		goto unlock;
+	}
 	reg &= ~(1 << nr);
 	reg &= ~(8 << nr);
 	if (has_temp_peci(data, nr) && (reg >> 6 == nr + 1 || val == 6))
 		reg &= 0x3f;
-	extra = data->read(data, IT87_REG_TEMP_EXTRA);
 	if (has_temp_old_peci(data, nr) && ((extra & 0x80) || val == 6))
 		extra &= 0x7f;
 	if (val == 2) {	/* backwards compatibility */
@@ -2895,33 +4252,75 @@ static ssize_t set_temp_type(struct device *dev, struct device_attribute *attr,
 	else if (has_temp_old_peci(data, nr) && val == 6)
 		extra |= 0x80;
 	else if (val != 0) {
-		count = -EINVAL;
+		err = -EINVAL;
 		goto unlock;
 	}
 
+	it87_cache_begin(data);
 	data->sensor = reg;
 	data->extra = extra;
+	it87_cache_end(data);
 	data->write(data, IT87_REG_TEMP_ENABLE, data->sensor);
 	if (has_temp_old_peci(data, nr))
 		data->write(data, IT87_REG_TEMP_EXTRA, data->extra);
-	data->valid = false;	/* Force cache refresh */
+	/* Force cache refresh */
+	it87_invalidate(data, BIT(IT87_CACHE_TEMP) | BIT(IT87_CACHE_PWM));
 unlock:
 	it87_unlock(data);
-	return count;
+	return err;
 }
 
-static SENSOR_DEVICE_ATTR(temp1_type, S_IRUGO | S_IWUSR, show_temp_type,
-			  set_temp_type, 0);
-static SENSOR_DEVICE_ATTR(temp2_type, S_IRUGO | S_IWUSR, show_temp_type,
-			  set_temp_type, 1);
-static SENSOR_DEVICE_ATTR(temp3_type, S_IRUGO | S_IWUSR, show_temp_type,
-			  set_temp_type, 2);
-static SENSOR_DEVICE_ATTR(temp4_type, S_IRUGO | S_IWUSR, show_temp_type,
-			  set_temp_type, 3);
-static SENSOR_DEVICE_ATTR(temp5_type, S_IRUGO | S_IWUSR, show_temp_type,
-			  set_temp_type, 4);
-static SENSOR_DEVICE_ATTR(temp6_type, S_IRUGO | S_IWUSR, show_temp_type,
-			  set_temp_type, 5);
+static int it87_temp_write(struct device *dev, u32 attr, int nr, long val)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int index, regval;
+	u8 reg;
+	int err;
+
+	switch (attr) {
+	case hwmon_temp_min:
+		index = 1;
+		reg = data->REG_TEMP_LOW[nr];
+		break;
+	case hwmon_temp_max:
+		index = 2;
+		reg = data->REG_TEMP_HIGH[nr];
+		break;
+	case hwmon_temp_offset:
+		index = 3;
+		reg = data->REG_TEMP_OFFSET[nr];
+		break;
+	case hwmon_temp_type:
+		return it87_write_temp_type(dev, nr, val);
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	err = it87_lock(data);
+	if (err)
+		return err;
+
+	if (index == 3) {
+		regval = data->read(data, IT87_REG_BEEP_ENABLE);
+		if (regval < 0) {
+			it87_unlock(data);
+			return regval;
+		}
+		if (!(regval & 0x80)) {
+			regval |= 0x80;
+			data->write(data, IT87_REG_BEEP_ENABLE, regval);
+		}
+		it87_invalidate(data, BIT(IT87_CACHE_TEMP) |
+				      BIT(IT87_CACHE_ALARM));
+	}
+
+	it87_cache_begin(data);
+	data->temp[nr][index] = TEMP_TO_REG(val);
+	it87_cache_end(data);
+	data->write(data, reg, data->temp[nr][index]);
+	it87_unlock(data);
+	return 0;
+}
 
 /* 6 Fans */
 
@@ -2934,159 +4333,109 @@ static int pwm_mode(const struct it87_data *data, int nr)
 		return 2;			/* Automatic mode */
 	if ((!has_fanctl_onoff(data) || nr >= 3) &&
 	    data->pwm_duty[nr] == pwm_to_reg(data, 0xff))
-		return 0;			/* Full speed */
-
-	return 1;				/* Manual mode */
-}
-
-static ssize_t show_fan(struct device *dev, struct device_attribute *attr,
-			char *buf)
-{
-	struct sensor_device_attribute_2 *sattr = to_sensor_dev_attr_2(attr);
-	int nr = sattr->nr;
-	int index = sattr->index;
-	int speed;
-	struct it87_data *data = it87_update_device(dev);
-
-	if (IS_ERR(data))
-		return PTR_ERR(data);
-
-	speed = has_16bit_fans(data) ?
-		FAN16_FROM_REG(data->fan[nr][index]) :
-		FAN_FROM_REG(data->fan[nr][index],
-			     DIV_FROM_REG(data->fan_div[nr]));
-	return sprintf(buf, "%d\n", speed);
-}
-
-static ssize_t show_fan_div(struct device *dev, struct device_attribute *attr,
-			    char *buf)
-{
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = it87_update_device(dev);
-	int nr = sensor_attr->index;
-
-	if (IS_ERR(data))
-		return PTR_ERR(data);
-
-	return sprintf(buf, "%lu\n", DIV_FROM_REG(data->fan_div[nr]));
-}
-
-static ssize_t show_pwm_enable(struct device *dev,
-			       struct device_attribute *attr, char *buf)
-{
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = it87_update_device(dev);
-	int nr = sensor_attr->index;
-
-	if (IS_ERR(data))
-		return PTR_ERR(data);
-
-	return sprintf(buf, "%d\n", pwm_mode(data, nr));
-}
-
-static ssize_t show_pwm(struct device *dev, struct device_attribute *attr,
-			char *buf)
-{
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = it87_update_device(dev);
-	int nr = sensor_attr->index;
-
-	if (IS_ERR(data))
-		return PTR_ERR(data);
-
-	return sprintf(buf, "%d\n",
-		       pwm_from_reg(data, data->pwm_duty[nr]));
-}
-
-static ssize_t show_pwm_freq(struct device *dev, struct device_attribute *attr,
-			     char *buf)
-{
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = it87_update_device(dev);
-	int nr = sensor_attr->index;
-	unsigned int freq;
-	int index;
-
-	if (IS_ERR(data))
-		return PTR_ERR(data);
-
-	if (has_pwm_freq2(data) && nr == 1)
-		index = (data->extra >> 4) & 0x07;
-	else
-		index = (data->fan_ctl >> 4) & 0x07;
-
-	freq = pwm_freq[index] / (has_newer_autopwm(data) ? 256 : 128);
+		return 0;			/* Full speed */
 
-	return sprintf(buf, "%u\n", freq);
+	return 1;				/* Manual mode */
 }
 
-static ssize_t set_fan(struct device *dev, struct device_attribute *attr,
-		       const char *buf, size_t count)
+static long it87_fan_speed(const struct it87_data *data, int nr, int index)
 {
-	struct sensor_device_attribute_2 *sattr = to_sensor_dev_attr_2(attr);
-	int nr = sattr->nr;
-	int index = sattr->index;
+	if (has_16bit_fans(data))
+		return FAN16_FROM_REG(data->fan[nr][index]);
+	return FAN_FROM_REG(data->fan[nr][index],
+			    DIV_FROM_REG(data->fan_div[nr]));
+}
 
-	struct it87_data *data = dev_get_drvdata(dev);
-	long val;
-	int err;
-	u8 reg;
+static int it87_fan_read(struct it87_data *data, u32 attr, int nr, long *val)
+{
+	switch (attr) {
+	case hwmon_fan_input:
+		*val = it87_fan_speed(data, nr, 0);
+		break;
+	case hwmon_fan_min:
+		*val = it87_fan_speed(data, nr, 1);
+		break;
+	case hwmon_fan_div:
+		*val = DIV_FROM_REG(data->fan_div[nr]);
+		break;
+	case hwmon_fan_alarm:
+		*val = (data->alarms >> it87_fan_alarm_bit[nr]) & 1;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	return 0;
+}
 
-	if (kstrtol(buf, 10, &val) < 0)
-		return -EINVAL;
+static int it87_pwm_read(struct it87_data *data, u32 attr, int nr, long *val)
+{
+	int index;
 
-	if (val < 0)
-		val = 0;
+	switch (attr) {
+	case hwmon_pwm_input:
+		*val = pwm_from_reg(data, data->pwm_duty[nr]);
+		break;
+	case hwmon_pwm_enable:
+		*val = pwm_mode(data, nr);
+		break;
+	case hwmon_pwm_freq:
+		if (has_pwm_freq2(data) && nr == 1)
+			index = (data->extra >> 4) & 0x07;
+		else
+			index = (data->fan_ctl >> 4) & 0x07;
+		*val = pwm_freq[index] / (has_newer_autopwm(data) ? 256 : 128);
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	return 0;
+}
 
-	err = it87_lock(data);
-	if (err)
-		return err;
+static int it87_write_fan_min(struct it87_data *data, int nr, long val)
+{
+	int reg;
+	u8 div;
 
 	if (has_16bit_fans(data)) {
-		data->fan[nr][index] = FAN16_TO_REG(val);
+		it87_cache_begin(data);
+		data->fan[nr][1] = FAN16_TO_REG(val);
+		it87_cache_end(data);
 		data->write(data, data->REG_FAN_MIN[nr],
-			    data->fan[nr][index] & 0xff);
+			    data->fan[nr][1] & 0xff);
 		data->write(data, data->REG_FANX_MIN[nr],
-			    data->fan[nr][index] >> 8);
+			    data->fan[nr][1] >> 8);
 	} else {
 		reg = data->read(data, IT87_REG_FAN_DIV);
+		if (reg < 0)
+			return reg;
 		switch (nr) {
 		case 0:
-			data->fan_div[nr] = reg & 0x07;
+			div = reg & 0x07;
 			break;
 		case 1:
-			data->fan_div[nr] = (reg >> 3) & 0x07;
+			div = (reg >> 3) & 0x07;
 			break;
-		case 2:
-			data->fan_div[nr] = (reg & 0x40) ? 3 : 1;
+		default:
+			div = (reg & 0x40) ? 3 : 1;
 			break;
 		}
-		data->fan[nr][index] =
-		  FAN_TO_REG(val, DIV_FROM_REG(data->fan_div[nr]));
-		data->write(data, data->REG_FAN_MIN[nr], data->fan[nr][index]);
+		it87_cache_begin(data);
+		data->fan_div[nr] = div;
+		data->fan[nr][1] = FAN_TO_REG(val, DIV_FROM_REG(div));
+		it87_cache_end(data);
+		data->write(data, data->REG_FAN_MIN[nr], data->fan[nr][1]);
 	}
-	it87_unlock(data);
-	return count;
+	return 0;
 }
 
-static ssize_t set_fan_div(struct device *dev, struct device_attribute *attr,
-			   const char *buf, size_t count)
+static int it87_write_fan_div(struct it87_data *data, int nr, long val)
 {
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = dev_get_drvdata(dev);
-	int nr = sensor_attr->index;
-	unsigned long val;
-	int min, err;
-	u8 old;
-
-	if (kstrtoul(buf, 10, &val) < 0)
-		return -EINVAL;
-
-	err = it87_lock(data);
-	if (err)
-		return err;
+	int min, old;
+	u8 div;
 
 	old = data->read(data, IT87_REG_FAN_DIV);
+	if (old < 0)
+		return old;
 
 	/* Save fan min limit */
 	min = FAN_FROM_REG(data->fan[nr][1], DIV_FROM_REG(data->fan_div[nr]));
@@ -3094,14 +4443,19 @@ static ssize_t set_fan_div(struct device *dev, struct device_attribute *attr,
 	switch (nr) {
 	case 0:
 	case 1:
-		data->fan_div[nr] = DIV_TO_REG(val);
+		div = DIV_TO_REG(val);
+		break;
+	default:
+		div = val < 8 ? 1 : 3;
 		break;
-	case 2:
-		if (val < 8)
-			data->fan_div[nr] = 1;
-		else
-			data->fan_div[nr] = 3;
 	}
+
+	/* The divisor and the min limit in its unit change together */
+	it87_cache_begin(data);
+	data->fan_div[nr] = div;
+	data->fan[nr][1] = FAN_TO_REG(min, DIV_FROM_REG(div));
+	it87_cache_end(data);
+
 	val = old & 0x80;
 	val |= (data->fan_div[0] & 0x07);
 	val |= (data->fan_div[1] & 0x07) << 3;
@@ -3110,34 +4464,61 @@ static ssize_t set_fan_div(struct device *dev, struct device_attribute *attr,
 	data->write(data, IT87_REG_FAN_DIV, val);
 
 	/* Restore fan min limit */
-	data->fan[nr][1] = FAN_TO_REG(min, DIV_FROM_REG(data->fan_div[nr]));
 	data->write(data, data->REG_FAN_MIN[nr], data->fan[nr][1]);
+	return 0;
+}
+
+static int it87_fan_write(struct device *dev, u32 attr, int nr, long val)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int err;
+
+	if (attr != hwmon_fan_min && attr != hwmon_fan_div)
+		return -EOPNOTSUPP;
+
+	err = it87_lock(data);
+	if (err)
+		return err;
+
+	if (attr == hwmon_fan_min)
+		err = it87_write_fan_min(data, nr, max(val, 0L));
+	else
+		err = it87_write_fan_div(data, nr, clamp_val(val, 0, 128));
+
 	it87_unlock(data);
-	return count;
+	return err;
 }
 
 /* Returns 0 if OK, -EINVAL otherwise */
-static int check_trip_points(struct device *dev, int nr)
+static int it87_check_curve(const struct it87_data *data, const s8 *temp,
+			    const u8 *pwm)
 {
-	const struct it87_data *data = dev_get_drvdata(dev);
 	int i, err = 0;
 
 	if (has_old_autopwm(data)) {
 		for (i = 0; i < 3; i++) {
-			if (data->auto_temp[nr][i] > data->auto_temp[nr][i + 1])
+			if (temp[i] > temp[i + 1])
 				err = -EINVAL;
 		}
 		for (i = 0; i < 2; i++) {
-			if (data->auto_pwm[nr][i] > data->auto_pwm[nr][i + 1])
+			if (pwm[i] > pwm[i + 1])
 				err = -EINVAL;
 		}
 	} else if (has_newer_autopwm(data)) {
 		for (i = 1; i < 3; i++) {
-			if (data->auto_temp[nr][i] > data->auto_temp[nr][i + 1])
+			if (temp[i] > temp[i + 1])
 				err = -EINVAL;
 		}
 	}
+	return err;
+}
+
+static int check_trip_points(struct device *dev, int nr)
+{
+	const struct it87_data *data = dev_get_drvdata(dev);
+	int err;
 
+	err = it87_check_curve(data, data->auto_temp[nr], data->auto_pwm[nr]);
 	if (err) {
 		dev_err(dev,
 			"Inconsistent trip points, not switching to automatic mode\n");
@@ -3153,20 +4534,23 @@ static int check_trip_points(struct device *dev, int nr)
  * Only call this when data->mmio_h2ram or data->ecio_h2ram is true.
  * For newer H2RAM based controllers with separate SmartFan toggle'
  */
-static void it87_update_smartfan_bit(struct it87_data *data, bool enable)
+static int it87_update_smartfan_bit(struct it87_data *data, bool enable)
 {
 	u8 	val;
 	int cur;
 
 	val = enable ? 0x01 : 0x00;
 	cur = data->read(data,IT87_SMARTFAN_ENABLE);
-	if (cur >= 0 && (u8)cur == val)
-	return;
+	if (cur < 0)
+		return cur;
+	if ((u8)cur == val)
+		return 0;
 	/* 0x947 is the SmartFan global control byte in H2RAM */
 	data->write(data, IT87_SMARTFAN_ENABLE, val);
+	return 0;
 }
 
-static void it87_update_smartfan_global(struct it87_data *data)
+static int it87_update_smartfan_global(struct it87_data *data)
 {
 	bool all_auto = true;
 	int  i;
@@ -3182,59 +4566,46 @@ static void it87_update_smartfan_global(struct it87_data *data)
 			break;
 		}
 	}
-	it87_update_smartfan_bit(data, all_auto);
+	return it87_update_smartfan_bit(data, all_auto);
 }
 
-static ssize_t set_pwm_enable(struct device *dev, struct device_attribute *attr,
-			      const char *buf, size_t count)
+/*
+ * Set the mode and the duty cycle of a PWM channel.
+ * Must be called with data->update_lock held, after it87_validate_pwm_ctrl().
+ */
+static int it87_write_pwm_enable(struct it87_data *data, int nr, long val)
 {
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = dev_get_drvdata(dev);
-	int nr = sensor_attr->index;
-	long val;
-	int err;
-
-	if (kstrtol(buf, 10, &val) < 0 || val < 0 || val > 2)
-		return -EINVAL;
-
-	/* Check trip points before switching to automatic mode */
-	if (val == 2) {
-		if (check_trip_points(dev, nr) < 0)
-			return -EINVAL;
-	}
-
-	err = it87_lock(data);
-	if (err)
-		return err;
-
-	it87_update_pwm_ctrl(data, nr);
-
 	if (val == 0) {
 		if (nr < 3 && has_fanctl_onoff(data)) {
 			int tmp;
 			/* make sure the fan is on when in on/off mode */
 			tmp = data->read(data, IT87_REG_FAN_CTL);
+			if (tmp < 0)
+				return tmp;
 			data->write(data, IT87_REG_FAN_CTL, tmp | BIT(nr));
 			/* set on/off mode */
+			it87_cache_begin(data);
 			data->fan_main_ctrl &= ~BIT(nr);
+			it87_cache_end(data);
 			data->write(data, IT87_REG_FAN_MAIN_CTRL,
 				    data->fan_main_ctrl);
 		} else {
-			u8 ctrl;
+			u8 ctrl, duty = pwm_to_reg(data, 0xff);
 
 			/* No on/off mode, set maximum pwm value */
-			data->pwm_duty[nr] = pwm_to_reg(data, 0xff);
-			data->write(data, IT87_REG_PWM_DUTY[nr],
-				    data->pwm_duty[nr]);
-			/* and set manual mode */
 			if (has_newer_autopwm(data)) {
 				ctrl = temp_map_to_reg(data, nr,
 						       data->pwm_temp_map[nr]);
 				ctrl &= 0x7f;
 			} else {
-				ctrl = data->pwm_duty[nr];
+				ctrl = duty;
 			}
+			it87_cache_begin(data);
+			data->pwm_duty[nr] = duty;
 			data->pwm_ctrl[nr] = ctrl;
+			it87_cache_end(data);
+			data->write(data, IT87_REG_PWM_DUTY[nr], duty);
+			/* and set manual mode */
 			data->write(data, data->REG_PWM[nr], ctrl);
 		}
 	} else {
@@ -3250,84 +4621,220 @@ static ssize_t set_pwm_enable(struct device *dev, struct device_attribute *attr,
 		} else {
 			ctrl = (val == 1 ? data->pwm_duty[nr] : 0x80);
 		}
+		it87_cache_begin(data);
 		data->pwm_ctrl[nr] = ctrl;
+		if (has_fanctl_onoff(data) && nr < 3)
+			data->fan_main_ctrl |= BIT(nr);
+		it87_cache_end(data);
 		data->write(data, data->REG_PWM[nr], ctrl);
 
 		if (has_fanctl_onoff(data) && nr < 3) {
 			/* set SmartGuardian mode */
-			data->fan_main_ctrl |= BIT(nr);
 			data->write(data, IT87_REG_FAN_MAIN_CTRL,
 				    data->fan_main_ctrl);
 		}
 	}
-
-	 /* If this device uses H2RAM/ECIO SmartFan, sync the global bit at 0x947 */
-	if (data->mmio_h2ram || data->ecio_h2ram) {
-		it87_update_smartfan_global(data);
-	}
-
-	it87_unlock(data);
-	return count;
+	return 0;
 }
 
-static ssize_t set_pwm(struct device *dev, struct device_attribute *attr,
-		       const char *buf, size_t count)
+static int it87_write_pwm(struct it87_data *data, int nr, long val)
 {
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = dev_get_drvdata(dev);
-	int nr = sensor_attr->index;
-	long val;
-	int err;
-
-	if (kstrtol(buf, 10, &val) < 0 || val < 0 || val > 255)
-		return -EINVAL;
-
-	err = it87_lock(data);
-	if (err)
-		return err;
-
-	it87_update_pwm_ctrl(data, nr);
 	if (has_newer_autopwm(data)) {
 		/*
 		 * If we are in automatic mode, the PWM duty cycle register
 		 * is read-only so we can't write the value.
 		 */
-		if (data->pwm_ctrl[nr] & 0x80) {
-			count = -EBUSY;
-			goto unlock;
-		}
+		if (data->pwm_ctrl[nr] & 0x80)
+			return -EBUSY;
+		if (data->pwm_duty[nr] == pwm_to_reg(data, val))
+			return 0;
+		it87_cache_begin(data);
 		data->pwm_duty[nr] = pwm_to_reg(data, val);
+		it87_cache_end(data);
 		data->write(data, IT87_REG_PWM_DUTY[nr],
 			    data->pwm_duty[nr]);
 	} else {
-		data->pwm_duty[nr] = pwm_to_reg(data, val);
+		u8 duty = pwm_to_reg(data, val);
 		/*
 		 * If we are in manual mode, write the duty cycle immediately;
 		 * otherwise, just store it for later use.
 		 */
-		if (!(data->pwm_ctrl[nr] & 0x80)) {
-			data->pwm_ctrl[nr] = data->pwm_duty[nr];
-			data->write(data, data->REG_PWM[nr],
-				    data->pwm_ctrl[nr]);
+		bool write = !(data->pwm_ctrl[nr] & 0x80) &&
+			     data->pwm_ctrl[nr] != duty;
+
+		it87_cache_begin(data);
+		data->pwm_duty[nr] = duty;
+		if (write)
+			data->pwm_ctrl[nr] = duty;
+		it87_cache_end(data);
+		if (write)
+			data->write(data, data->REG_PWM[nr], duty);
+	}
+	return 0;
+}
+
+/*
+ * pwm_all and pwm_enable_all take one value per PWM channel which exists,
+ * in channel order, separated by spaces; "-" leaves a channel alone. All
+ * values are checked first, and then applied under a single lock, so that
+ * all fans change together.
+ */
+static int it87_parse_pwm_vector(struct it87_data *data, const char *buf,
+				 long max, long *vals)
+{
+	char *str, *tok, *p;
+	int nr, err = 0;
+
+	str = kstrdup(buf, GFP_KERNEL);
+	if (!str)
+		return -ENOMEM;
+
+	p = strim(str);
+	for (nr = 0; nr < NUM_PWM; nr++) {
+		vals[nr] = -1;
+		if (!(data->has_pwm & BIT(nr)))
+			continue;
+		do {
+			tok = strsep(&p, " \t");
+		} while (tok && !*tok);
+		if (!tok) {
+			err = -EINVAL;
+			break;
+		}
+		if (!strcmp(tok, "-"))
+			continue;
+		if (kstrtol(tok, 10, &vals[nr]) < 0 ||
+		    vals[nr] < 0 || vals[nr] > max) {
+			err = -EINVAL;
+			break;
+		}
+	}
+	if (!err && p && *skip_spaces(p))
+		err = -EINVAL;	/* Too many values */
+
+	kfree(str);
+	return err;
+}
+
+static ssize_t it87_show_pwm_vector(struct device *dev, char *buf, bool mode)
+{
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_PWM));
+	int val[NUM_PWM];
+	unsigned int seq;
+	int nr, len = 0;
+
+	if (IS_ERR(data))
+		return PTR_ERR(data);
+
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		for (nr = 0; nr < NUM_PWM; nr++)
+			val[nr] = mode ? pwm_mode(data, nr) :
+				  pwm_from_reg(data, data->pwm_duty[nr]);
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	for (nr = 0; nr < NUM_PWM; nr++) {
+		if (!(data->has_pwm & BIT(nr)))
+			continue;
+		len += sprintf(buf + len, "%s%d", len ? " " : "", val[nr]);
+	}
+	return len + sprintf(buf + len, "\n");
+}
+
+static ssize_t show_pwm_all(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	return it87_show_pwm_vector(dev, buf, false);
+}
+
+static ssize_t show_pwm_enable_all(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	return it87_show_pwm_vector(dev, buf, true);
+}
+
+static ssize_t set_pwm_all(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	long vals[NUM_PWM];
+	int nr, err;
+
+	err = it87_parse_pwm_vector(data, buf, 255, vals);
+	if (err)
+		return err;
+
+	err = it87_lock(data);
+	if (err)
+		return err;
+
+	/* Don't change anything if some channel is under automatic control */
+	for (nr = 0; nr < NUM_PWM; nr++) {
+		if (vals[nr] < 0)
+			continue;
+		err = it87_validate_pwm_ctrl(data, nr);
+		if (err)
+			goto unlock;
+		if (has_newer_autopwm(data) && (data->pwm_ctrl[nr] & 0x80)) {
+			err = -EBUSY;
+			goto unlock;
 		}
 	}
+	for (nr = 0; nr < NUM_PWM; nr++)
+		if (vals[nr] >= 0)
+			it87_write_pwm(data, nr, vals[nr]);
 unlock:
 	it87_unlock(data);
-	return count;
+	return err ? err : count;
 }
 
-static ssize_t set_pwm_freq(struct device *dev, struct device_attribute *attr,
-			    const char *buf, size_t count)
+static ssize_t set_pwm_enable_all(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
 {
-	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
 	struct it87_data *data = dev_get_drvdata(dev);
-	int nr = sensor_attr->index;
-	unsigned long val;
-	int err;
-	int i;
+	long vals[NUM_PWM];
+	int nr, err;
 
-	if (kstrtoul(buf, 10, &val) < 0)
-		return -EINVAL;
+	err = it87_parse_pwm_vector(data, buf, 2, vals);
+	if (err)
+		return err;
+
+	for (nr = 0; nr < NUM_PWM; nr++) {
+		if (vals[nr] == 2 && check_trip_points(dev, nr) < 0)
+			return -EINVAL;
+	}
+
+	err = it87_lock(data);
+	if (err)
+		return err;
+
+	for (nr = 0; nr < NUM_PWM; nr++) {
+		if (vals[nr] < 0)
+			continue;
+		err = it87_validate_pwm_ctrl(data, nr);
+		if (!err)
+			err = it87_write_pwm_enable(data, nr, vals[nr]);
+		if (err)
+			goto unlock;
+	}
+
+	if (data->mmio_h2ram || data->ecio_h2ram)
+		err = it87_update_smartfan_global(data);
+unlock:
+	it87_unlock(data);
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(pwm_all, S_IRUGO | S_IWUSR, show_pwm_all, set_pwm_all);
+static DEVICE_ATTR(pwm_enable_all, S_IRUGO | S_IWUSR, show_pwm_enable_all,
+		   set_pwm_enable_all);
+
+static int it87_write_pwm_freq(struct it87_data *data, int nr, long val)
+{
+	int err, reg;
+	int i;
 
 	val = clamp_val(val, 0, 1000000);
 	val *= has_newer_autopwm(data) ? 256 : 128;
@@ -3343,29 +4850,92 @@ static ssize_t set_pwm_freq(struct device *dev, struct device_attribute *attr,
 		return err;
 
 	if (nr == 0) {
-		data->fan_ctl = data->read(data, IT87_REG_FAN_CTL) & 0x8f;
-		data->fan_ctl |= i << 4;
-		data->write(data, IT87_REG_FAN_CTL, data->fan_ctl);
+		reg = data->read(data, IT87_REG_FAN_CTL);
+		if (reg < 0)
+			goto unlock;
+		reg = (reg & 0x8f) | i << 4;
+		it87_cache_begin(data);
+		data->fan_ctl = reg;
+		it87_cache_end(data);
+		data->write(data, IT87_REG_FAN_CTL, reg);
 	} else {
-		data->extra = data->read(data, IT87_REG_TEMP_EXTRA) & 0x8f;
-		data->extra |= i << 4;
-		data->write(data, IT87_REG_TEMP_EXTRA, data->extra);
+		reg = data->read(data, IT87_REG_TEMP_EXTRA);
+		if (reg < 0)
+			goto unlock;
+		reg = (reg & 0x8f) | i << 4;
+		it87_cache_begin(data);
+		data->extra = reg;
+		it87_cache_end(data);
+		data->write(data, IT87_REG_TEMP_EXTRA, reg);
 	}
+unlock:
 	it87_unlock(data);
-	return count;
+	return reg < 0 ? reg : 0;
+}
+
+static int it87_pwm_write(struct device *dev, u32 attr, int nr, long val)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int err;
+
+	switch (attr) {
+	case hwmon_pwm_input:
+		if (val < 0 || val > 255)
+			return -EINVAL;
+		break;
+	case hwmon_pwm_enable:
+		if (val < 0 || val > 2)
+			return -EINVAL;
+		/* Check trip points before switching to automatic mode */
+		if (val == 2 && check_trip_points(dev, nr) < 0)
+			return -EINVAL;
+		break;
+	case hwmon_pwm_freq:
+		return it87_write_pwm_freq(data, nr, val);
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	err = it87_lock(data);
+	if (err)
+		return err;
+
+	err = it87_validate_pwm_ctrl(data, nr);
+	if (err)
+		goto unlock;
+	if (attr == hwmon_pwm_input) {
+		err = it87_write_pwm(data, nr, val);
+	} else {
+		err = it87_write_pwm_enable(data, nr, val);
+
+		/* If this device uses H2RAM/ECIO SmartFan, sync the global bit at 0x947 */
+		if (!err && (data->mmio_h2ram || data->ecio_h2ram))
+			err = it87_update_smartfan_global(data);
+	}
+unlock:
+	it87_unlock(data);
+	return err;
 }
 
 static ssize_t show_pwm_temp_map(struct device *dev,
 				 struct device_attribute *attr, char *buf)
 {
 	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
-	struct it87_data *data = it87_update_device(dev);
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_PWM));
 	int nr = sensor_attr->index;
+	unsigned int seq;
+	int map;
 
 	if (IS_ERR(data))
 		return PTR_ERR(data);
 
-	return sprintf(buf, "%d\n", data->pwm_temp_map[nr] + 1);
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		map = data->pwm_temp_map[nr];
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	return sprintf(buf, "%d\n", map + 1);
 }
 
 static ssize_t set_pwm_temp_map(struct device *dev,
@@ -3391,16 +4961,22 @@ static ssize_t set_pwm_temp_map(struct device *dev,
 	if (err)
 		return err;
 
-	it87_update_pwm_ctrl(data, nr);
+	err = it87_validate_pwm_ctrl(data, nr);
+	if (err) {
+		it87_unlock(data);
+		return err;
+	}
+	it87_cache_begin(data);
 	data->pwm_temp_map[nr] = map;
 	/*
 	 * If we are in automatic mode, write the temp mapping immediately;
 	 * otherwise, just store it for later use.
 	 */
-	if (data->pwm_ctrl[nr] & 0x80) {
+	if (data->pwm_ctrl[nr] & 0x80)
 		data->pwm_ctrl[nr] = temp_map_to_reg(data, nr, map);
+	it87_cache_end(data);
+	if (data->pwm_ctrl[nr] & 0x80)
 		data->write(data, data->REG_PWM[nr], data->pwm_ctrl[nr]);
-	}
 	it87_unlock(data);
 	return count;
 }
@@ -3408,17 +4984,24 @@ static ssize_t set_pwm_temp_map(struct device *dev,
 static ssize_t show_auto_pwm(struct device *dev, struct device_attribute *attr,
 			     char *buf)
 {
-	struct it87_data *data = it87_update_device(dev);
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_LIMIT));
 	struct sensor_device_attribute_2 *sensor_attr =
 			to_sensor_dev_attr_2(attr);
 	int nr = sensor_attr->nr;
 	int point = sensor_attr->index;
+	unsigned int seq;
+	int val;
 
 	if (IS_ERR(data))
 		return PTR_ERR(data);
 
-	return sprintf(buf, "%d\n",
-		       pwm_from_reg(data, data->auto_pwm[nr][point]));
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		val = pwm_from_reg(data, data->auto_pwm[nr][point]);
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	return sprintf(buf, "%d\n", val);
 }
 
 static ssize_t set_auto_pwm(struct device *dev, struct device_attribute *attr,
@@ -3440,7 +5023,9 @@ static ssize_t set_auto_pwm(struct device *dev, struct device_attribute *attr,
 	if (err)
 		return err;
 
+	it87_cache_begin(data);
 	data->auto_pwm[nr][point] = pwm_to_reg(data, val);
+	it87_cache_end(data);
 	if (has_newer_autopwm(data))
 		regaddr = IT87_REG_AUTO_TEMP(nr, 3);
 	else
@@ -3453,14 +5038,22 @@ static ssize_t set_auto_pwm(struct device *dev, struct device_attribute *attr,
 static ssize_t show_auto_pwm_slope(struct device *dev,
 				   struct device_attribute *attr, char *buf)
 {
-	struct it87_data *data = it87_update_device(dev);
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_LIMIT));
 	struct sensor_device_attribute *sensor_attr = to_sensor_dev_attr(attr);
 	int nr = sensor_attr->index;
+	unsigned int seq;
+	u8 slope;
 
 	if (IS_ERR(data))
 		return PTR_ERR(data);
 
-	return sprintf(buf, "%d\n", data->auto_pwm[nr][1] & 0x7f);
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		slope = data->auto_pwm[nr][1] & 0x7f;
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	return sprintf(buf, "%d\n", slope);
 }
 
 static ssize_t set_auto_pwm_slope(struct device *dev,
@@ -3480,7 +5073,9 @@ static ssize_t set_auto_pwm_slope(struct device *dev,
 	if (err)
 		return err;
 
+	it87_cache_begin(data);
 	data->auto_pwm[nr][1] = (data->auto_pwm[nr][1] & 0x80) | val;
+	it87_cache_end(data);
 	data->write(data, IT87_REG_AUTO_TEMP(nr, 4), data->auto_pwm[nr][1]);
 	it87_unlock(data);
 	return count;
@@ -3489,20 +5084,26 @@ static ssize_t set_auto_pwm_slope(struct device *dev,
 static ssize_t show_auto_temp(struct device *dev, struct device_attribute *attr,
 			      char *buf)
 {
-	struct it87_data *data = it87_update_device(dev);
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_LIMIT));
 	struct sensor_device_attribute_2 *sensor_attr =
 			to_sensor_dev_attr_2(attr);
 	int nr = sensor_attr->nr;
 	int point = sensor_attr->index;
+	unsigned int seq;
 	int reg;
 
 	if (IS_ERR(data))
 		return PTR_ERR(data);
 
-	if (has_old_autopwm(data) || point)
-		reg = data->auto_temp[nr][point];
-	else
-		reg = data->auto_temp[nr][1] - (data->auto_temp[nr][0] & 0x1f);
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		if (has_old_autopwm(data) || point)
+			reg = data->auto_temp[nr][point];
+		else
+			reg = data->auto_temp[nr][1] -
+			      (data->auto_temp[nr][0] & 0x1f);
+	} while (read_seqcount_retry(&data->seq, seq));
 
 	return sprintf(buf, "%d\n", TEMP_FROM_REG(reg));
 }
@@ -3529,11 +5130,15 @@ static ssize_t set_auto_temp(struct device *dev, struct device_attribute *attr,
 	if (has_newer_autopwm(data) && !point) {
 		reg = data->auto_temp[nr][1] - TEMP_TO_REG(val);
 		reg = clamp_val(reg, 0, 0x1f) | (data->auto_temp[nr][0] & 0xe0);
+		it87_cache_begin(data);
 		data->auto_temp[nr][0] = reg;
+		it87_cache_end(data);
 		data->write(data, IT87_REG_AUTO_TEMP(nr, 5), reg);
 	} else {
 		reg = TEMP_TO_REG(val);
+		it87_cache_begin(data);
 		data->auto_temp[nr][point] = reg;
+		it87_cache_end(data);
 		if (has_newer_autopwm(data))
 			point--;
 		data->write(data, IT87_REG_AUTO_TEMP(nr, point), reg);
@@ -3542,41 +5147,161 @@ static ssize_t set_auto_temp(struct device *dev, struct device_attribute *attr,
 	return count;
 }
 
-static SENSOR_DEVICE_ATTR_2(fan1_input, S_IRUGO, show_fan, NULL, 0, 0);
-static SENSOR_DEVICE_ATTR_2(fan1_min, S_IRUGO | S_IWUSR, show_fan, set_fan,
-			    0, 1);
-static SENSOR_DEVICE_ATTR(fan1_div, S_IRUGO | S_IWUSR, show_fan_div,
-			  set_fan_div, 0);
-
-static SENSOR_DEVICE_ATTR_2(fan2_input, S_IRUGO, show_fan, NULL, 1, 0);
-static SENSOR_DEVICE_ATTR_2(fan2_min, S_IRUGO | S_IWUSR, show_fan, set_fan,
-			    1, 1);
-static SENSOR_DEVICE_ATTR(fan2_div, S_IRUGO | S_IWUSR, show_fan_div,
-			  set_fan_div, 1);
-
-static SENSOR_DEVICE_ATTR_2(fan3_input, S_IRUGO, show_fan, NULL, 2, 0);
-static SENSOR_DEVICE_ATTR_2(fan3_min, S_IRUGO | S_IWUSR, show_fan, set_fan,
-			    2, 1);
-static SENSOR_DEVICE_ATTR(fan3_div, S_IRUGO | S_IWUSR, show_fan_div,
-			  set_fan_div, 2);
-
-static SENSOR_DEVICE_ATTR_2(fan4_input, S_IRUGO, show_fan, NULL, 3, 0);
-static SENSOR_DEVICE_ATTR_2(fan4_min, S_IRUGO | S_IWUSR, show_fan, set_fan,
-			    3, 1);
-
-static SENSOR_DEVICE_ATTR_2(fan5_input, S_IRUGO, show_fan, NULL, 4, 0);
-static SENSOR_DEVICE_ATTR_2(fan5_min, S_IRUGO | S_IWUSR, show_fan, set_fan,
-			    4, 1);
-
-static SENSOR_DEVICE_ATTR_2(fan6_input, S_IRUGO, show_fan, NULL, 5, 0);
-static SENSOR_DEVICE_ATTR_2(fan6_min, S_IRUGO | S_IWUSR, show_fan, set_fan,
-			    5, 1);
-
-static SENSOR_DEVICE_ATTR(pwm1_enable, S_IRUGO | S_IWUSR,
-			  show_pwm_enable, set_pwm_enable, 0);
-static SENSOR_DEVICE_ATTR(pwm1, S_IRUGO | S_IWUSR, show_pwm, set_pwm, 0);
-static SENSOR_DEVICE_ATTR(pwm1_freq, S_IRUGO | S_IWUSR, show_pwm_freq,
-			  set_pwm_freq, 0);
+/*
+ * pwmN_auto_curve sets a whole automatic fan control curve at once, which
+ * is only checked for consistency once it is complete. It takes the values
+ * of the individual attributes, in this order:
+ *   newer chips: point1_temp_hyst point1_temp point2_temp point3_temp
+ *                auto_start auto_slope
+ *   older chips: point1_temp_hyst point1_temp .. point4_temp
+ *                point1_pwm .. point3_pwm
+ */
+static ssize_t show_auto_curve(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_LIMIT));
+	int nr = to_sensor_dev_attr(attr)->index;
+	s8 temp[ARRAY_SIZE(data->auto_temp[0])];
+	u8 pwm[ARRAY_SIZE(data->auto_pwm[0])];
+	unsigned int seq;
+	int hyst;
+
+	if (IS_ERR(data))
+		return PTR_ERR(data);
+
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		memcpy(temp, data->auto_temp[nr], sizeof(temp));
+		memcpy(pwm, data->auto_pwm[nr], sizeof(pwm));
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	if (has_newer_autopwm(data)) {
+		hyst = temp[1] - (temp[0] & 0x1f);
+		return sprintf(buf, "%d %d %d %d %d %d\n",
+			       TEMP_FROM_REG(hyst), TEMP_FROM_REG(temp[1]),
+			       TEMP_FROM_REG(temp[2]), TEMP_FROM_REG(temp[3]),
+			       pwm_from_reg(data, pwm[0]), pwm[1] & 0x7f);
+	}
+
+	return sprintf(buf, "%d %d %d %d %d %d %d %d\n",
+		       TEMP_FROM_REG(temp[0]), TEMP_FROM_REG(temp[1]),
+		       TEMP_FROM_REG(temp[2]), TEMP_FROM_REG(temp[3]),
+		       TEMP_FROM_REG(temp[4]), pwm_from_reg(data, pwm[0]),
+		       pwm_from_reg(data, pwm[1]), pwm_from_reg(data, pwm[2]));
+}
+
+/* Registers of a curve, with their cached and new values */
+struct it87_curve_reg {
+	u16 reg;
+	u8 *cache;
+	u8 val;
+};
+
+static void it87_curve_reg(struct it87_curve_reg *r, u16 reg, u8 *cache,
+			   u8 val)
+{
+	r->reg = reg;
+	r->cache = cache;
+	r->val = val;
+}
+
+static ssize_t set_auto_curve(struct device *dev,
+			      struct device_attribute *attr,
+			      const char *buf, size_t count)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int nr = to_sensor_dev_attr(attr)->index;
+	bool newer = has_newer_autopwm(data);
+	struct it87_curve_reg regs[8];
+	unsigned long changed = 0;
+	s8 temp[5];
+	u8 pwm[3];
+	long val[8];
+	int i, n, err;
+
+	n = sscanf(buf, "%ld %ld %ld %ld %ld %ld %ld %ld", &val[0], &val[1],
+		   &val[2], &val[3], &val[4], &val[5], &val[6], &val[7]);
+	if (n != (newer ? 6 : 8))
+		return -EINVAL;
+
+	for (i = 0; i < (newer ? 4 : 5); i++) {
+		if (val[i] < -128000 || val[i] > 127000)
+			return -EINVAL;
+		temp[i] = TEMP_TO_REG(val[i]);
+	}
+	for (; i < n; i++)
+		if (val[i] < 0 || val[i] > 255)
+			return -EINVAL;
+	if (newer) {
+		if (val[5] > 127)
+			return -EINVAL;
+		pwm[0] = pwm_to_reg(data, val[4]);
+	} else {
+		for (i = 0; i < 3; i++)
+			pwm[i] = pwm_to_reg(data, val[5 + i]);
+	}
+
+	if (it87_check_curve(data, temp, pwm))
+		return -EINVAL;
+
+	err = it87_lock(data);
+	if (err)
+		return err;
+
+	n = 0;
+	if (newer) {
+		u8 *cur = (u8 *)data->auto_temp[nr];
+
+		for (i = 1; i < 4; i++)
+			it87_curve_reg(&regs[n++], IT87_REG_AUTO_TEMP(nr, i - 1),
+				       &cur[i], temp[i]);
+		it87_curve_reg(&regs[n++], IT87_REG_AUTO_TEMP(nr, 5), &cur[0],
+			       clamp_val(temp[1] - temp[0], 0, 0x1f) |
+			       (cur[0] & 0xe0));
+		it87_curve_reg(&regs[n++], IT87_REG_AUTO_TEMP(nr, 3),
+			       &data->auto_pwm[nr][0], pwm[0]);
+		it87_curve_reg(&regs[n++], IT87_REG_AUTO_TEMP(nr, 4),
+			       &data->auto_pwm[nr][1],
+			       (data->auto_pwm[nr][1] & 0x80) | val[5]);
+	} else {
+		for (i = 0; i < 5; i++)
+			it87_curve_reg(&regs[n++], IT87_REG_AUTO_TEMP(nr, i),
+				       (u8 *)&data->auto_temp[nr][i], temp[i]);
+		for (i = 0; i < 3; i++)
+			it87_curve_reg(&regs[n++], IT87_REG_AUTO_PWM(nr, i),
+				       &data->auto_pwm[nr][i], pwm[i]);
+	}
+
+	/* Update the whole curve at once, and only write what changed */
+	it87_cache_begin(data);
+	for (i = 0; i < n; i++) {
+		if (*regs[i].cache == regs[i].val)
+			continue;
+		*regs[i].cache = regs[i].val;
+		changed |= BIT(i);
+	}
+	it87_cache_end(data);
+	for_each_set_bit(i, &changed, n)
+		data->write(data, regs[i].reg, regs[i].val);
+
+	it87_unlock(data);
+	return count;
+}
+
+static SENSOR_DEVICE_ATTR(pwm1_auto_curve, S_IRUGO | S_IWUSR,
+			  show_auto_curve, set_auto_curve, 0);
+static SENSOR_DEVICE_ATTR(pwm2_auto_curve, S_IRUGO | S_IWUSR,
+			  show_auto_curve, set_auto_curve, 1);
+static SENSOR_DEVICE_ATTR(pwm3_auto_curve, S_IRUGO | S_IWUSR,
+			  show_auto_curve, set_auto_curve, 2);
+static SENSOR_DEVICE_ATTR(pwm4_auto_curve, S_IRUGO | S_IWUSR,
+			  show_auto_curve, set_auto_curve, 3);
+static SENSOR_DEVICE_ATTR(pwm5_auto_curve, S_IRUGO | S_IWUSR,
+			  show_auto_curve, set_auto_curve, 4);
+static SENSOR_DEVICE_ATTR(pwm6_auto_curve, S_IRUGO | S_IWUSR,
+			  show_auto_curve, set_auto_curve, 5);
+
 static SENSOR_DEVICE_ATTR(pwm1_auto_channels_temp, S_IRUGO,
 			  show_pwm_temp_map, set_pwm_temp_map, 0);
 static SENSOR_DEVICE_ATTR_2(pwm1_auto_point1_pwm, S_IRUGO | S_IWUSR,
@@ -3602,10 +5327,6 @@ static SENSOR_DEVICE_ATTR_2(pwm1_auto_start, S_IRUGO | S_IWUSR,
 static SENSOR_DEVICE_ATTR(pwm1_auto_slope, S_IRUGO | S_IWUSR,
 			  show_auto_pwm_slope, set_auto_pwm_slope, 0);
 
-static SENSOR_DEVICE_ATTR(pwm2_enable, S_IRUGO | S_IWUSR,
-			  show_pwm_enable, set_pwm_enable, 1);
-static SENSOR_DEVICE_ATTR(pwm2, S_IRUGO | S_IWUSR, show_pwm, set_pwm, 1);
-static SENSOR_DEVICE_ATTR(pwm2_freq, S_IRUGO, show_pwm_freq, set_pwm_freq, 1);
 static SENSOR_DEVICE_ATTR(pwm2_auto_channels_temp, S_IRUGO,
 			  show_pwm_temp_map, set_pwm_temp_map, 1);
 static SENSOR_DEVICE_ATTR_2(pwm2_auto_point1_pwm, S_IRUGO | S_IWUSR,
@@ -3631,10 +5352,6 @@ static SENSOR_DEVICE_ATTR_2(pwm2_auto_start, S_IRUGO | S_IWUSR,
 static SENSOR_DEVICE_ATTR(pwm2_auto_slope, S_IRUGO | S_IWUSR,
 			  show_auto_pwm_slope, set_auto_pwm_slope, 1);
 
-static SENSOR_DEVICE_ATTR(pwm3_enable, S_IRUGO | S_IWUSR,
-			  show_pwm_enable, set_pwm_enable, 2);
-static SENSOR_DEVICE_ATTR(pwm3, S_IRUGO | S_IWUSR, show_pwm, set_pwm, 2);
-static SENSOR_DEVICE_ATTR(pwm3_freq, S_IRUGO, show_pwm_freq, NULL, 2);
 static SENSOR_DEVICE_ATTR(pwm3_auto_channels_temp, S_IRUGO,
 			  show_pwm_temp_map, set_pwm_temp_map, 2);
 static SENSOR_DEVICE_ATTR_2(pwm3_auto_point1_pwm, S_IRUGO | S_IWUSR,
@@ -3660,10 +5377,6 @@ static SENSOR_DEVICE_ATTR_2(pwm3_auto_start, S_IRUGO | S_IWUSR,
 static SENSOR_DEVICE_ATTR(pwm3_auto_slope, S_IRUGO | S_IWUSR,
 			  show_auto_pwm_slope, set_auto_pwm_slope, 2);
 
-static SENSOR_DEVICE_ATTR(pwm4_enable, S_IRUGO | S_IWUSR,
-			  show_pwm_enable, set_pwm_enable, 3);
-static SENSOR_DEVICE_ATTR(pwm4, S_IRUGO | S_IWUSR, show_pwm, set_pwm, 3);
-static SENSOR_DEVICE_ATTR(pwm4_freq, S_IRUGO, show_pwm_freq, NULL, 3);
 static SENSOR_DEVICE_ATTR(pwm4_auto_channels_temp, S_IRUGO,
 			  show_pwm_temp_map, set_pwm_temp_map, 3);
 static SENSOR_DEVICE_ATTR_2(pwm4_auto_point1_temp, S_IRUGO | S_IWUSR,
@@ -3679,10 +5392,6 @@ static SENSOR_DEVICE_ATTR_2(pwm4_auto_start, S_IRUGO | S_IWUSR,
 static SENSOR_DEVICE_ATTR(pwm4_auto_slope, S_IRUGO | S_IWUSR,
 			  show_auto_pwm_slope, set_auto_pwm_slope, 3);
 
-static SENSOR_DEVICE_ATTR(pwm5_enable, S_IRUGO | S_IWUSR,
-			  show_pwm_enable, set_pwm_enable, 4);
-static SENSOR_DEVICE_ATTR(pwm5, S_IRUGO | S_IWUSR, show_pwm, set_pwm, 4);
-static SENSOR_DEVICE_ATTR(pwm5_freq, S_IRUGO, show_pwm_freq, NULL, 4);
 static SENSOR_DEVICE_ATTR(pwm5_auto_channels_temp, S_IRUGO,
 			  show_pwm_temp_map, set_pwm_temp_map, 4);
 static SENSOR_DEVICE_ATTR_2(pwm5_auto_point1_temp, S_IRUGO | S_IWUSR,
@@ -3698,10 +5407,6 @@ static SENSOR_DEVICE_ATTR_2(pwm5_auto_start, S_IRUGO | S_IWUSR,
 static SENSOR_DEVICE_ATTR(pwm5_auto_slope, S_IRUGO | S_IWUSR,
 			  show_auto_pwm_slope, set_auto_pwm_slope, 4);
 
-static SENSOR_DEVICE_ATTR(pwm6_enable, S_IRUGO | S_IWUSR,
-			  show_pwm_enable, set_pwm_enable, 5);
-static SENSOR_DEVICE_ATTR(pwm6, S_IRUGO | S_IWUSR, show_pwm, set_pwm, 5);
-static SENSOR_DEVICE_ATTR(pwm6_freq, S_IRUGO, show_pwm_freq, NULL, 5);
 static SENSOR_DEVICE_ATTR(pwm6_auto_channels_temp, S_IRUGO,
 			  show_pwm_temp_map, set_pwm_temp_map, 5);
 static SENSOR_DEVICE_ATTR_2(pwm6_auto_point1_temp, S_IRUGO | S_IWUSR,
@@ -3718,28 +5423,24 @@ static SENSOR_DEVICE_ATTR(pwm6_auto_slope, S_IRUGO | S_IWUSR,
 			  show_auto_pwm_slope, set_auto_pwm_slope, 5);
 
 /* Alarms */
-static ssize_t show_alarms(struct device *dev, struct device_attribute *attr,
-			   char *buf)
-{
-	struct it87_data *data = it87_update_device(dev);
-
-	if (IS_ERR(data))
-		return PTR_ERR(data);
-
-	return sprintf(buf, "%u\n", data->alarms);
-}
-static DEVICE_ATTR(alarms, S_IRUGO, show_alarms, NULL);
-
 static ssize_t show_alarm(struct device *dev, struct device_attribute *attr,
 			  char *buf)
 {
-	struct it87_data *data = it87_update_device(dev);
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_ALARM));
 	int bitnr = to_sensor_dev_attr(attr)->index;
+	unsigned int seq;
+	u32 bits;
 
 	if (IS_ERR(data))
 		return PTR_ERR(data);
 
-	return sprintf(buf, "%u\n", (data->alarms >> bitnr) & 1);
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		bits = data->alarms;
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	return sprintf(buf, "%u\n", (bits >> bitnr) & 1);
 }
 
 static ssize_t clear_intrusion(struct device *dev,
@@ -3758,47 +5459,37 @@ static ssize_t clear_intrusion(struct device *dev,
 		return err;
 
 	config = data->read(data, IT87_REG_CONFIG);
-	config |= BIT(5);
-	data->write(data, IT87_REG_CONFIG, config);
-	/* Invalidate cache to force re-read */
-	data->valid = false;
+	if (config >= 0) {
+		config |= BIT(5);
+		data->write(data, IT87_REG_CONFIG, config);
+		/* Invalidate cache to force re-read */
+		it87_invalidate(data, BIT(IT87_CACHE_ALARM));
+	}
 	it87_unlock(data);
-	return count;
+	return config < 0 ? config : count;
 }
 
-static SENSOR_DEVICE_ATTR(in0_alarm, S_IRUGO, show_alarm, NULL, 8);
-static SENSOR_DEVICE_ATTR(in1_alarm, S_IRUGO, show_alarm, NULL, 9);
-static SENSOR_DEVICE_ATTR(in2_alarm, S_IRUGO, show_alarm, NULL, 10);
-static SENSOR_DEVICE_ATTR(in3_alarm, S_IRUGO, show_alarm, NULL, 11);
-static SENSOR_DEVICE_ATTR(in4_alarm, S_IRUGO, show_alarm, NULL, 12);
-static SENSOR_DEVICE_ATTR(in5_alarm, S_IRUGO, show_alarm, NULL, 13);
-static SENSOR_DEVICE_ATTR(in6_alarm, S_IRUGO, show_alarm, NULL, 14);
-static SENSOR_DEVICE_ATTR(in7_alarm, S_IRUGO, show_alarm, NULL, 15);
-static SENSOR_DEVICE_ATTR(fan1_alarm, S_IRUGO, show_alarm, NULL, 0);
-static SENSOR_DEVICE_ATTR(fan2_alarm, S_IRUGO, show_alarm, NULL, 1);
-static SENSOR_DEVICE_ATTR(fan3_alarm, S_IRUGO, show_alarm, NULL, 2);
-static SENSOR_DEVICE_ATTR(fan4_alarm, S_IRUGO, show_alarm, NULL, 3);
-static SENSOR_DEVICE_ATTR(fan5_alarm, S_IRUGO, show_alarm, NULL, 6);
-static SENSOR_DEVICE_ATTR(fan6_alarm, S_IRUGO, show_alarm, NULL, 7);
-static SENSOR_DEVICE_ATTR(temp1_alarm, S_IRUGO, show_alarm, NULL, 16);
-static SENSOR_DEVICE_ATTR(temp2_alarm, S_IRUGO, show_alarm, NULL, 17);
-static SENSOR_DEVICE_ATTR(temp3_alarm, S_IRUGO, show_alarm, NULL, 18);
-static SENSOR_DEVICE_ATTR(temp4_alarm, S_IRUGO, show_alarm, NULL, 19);
-static SENSOR_DEVICE_ATTR(temp5_alarm, S_IRUGO, show_alarm, NULL, 20);
-static SENSOR_DEVICE_ATTR(temp6_alarm, S_IRUGO, show_alarm, NULL, 21);
 static SENSOR_DEVICE_ATTR(intrusion0_alarm, S_IRUGO | S_IWUSR,
 			  show_alarm, clear_intrusion, 4);
 
 static ssize_t show_beep(struct device *dev, struct device_attribute *attr,
 			 char *buf)
 {
-	struct it87_data *data = it87_update_device(dev);
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_ALARM));
 	int bitnr = to_sensor_dev_attr(attr)->index;
+	unsigned int seq;
+	u32 bits;
 
 	if (IS_ERR(data))
 		return PTR_ERR(data);
 
-	return sprintf(buf, "%u\n", (data->beeps >> bitnr) & 1);
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		bits = data->beeps;
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	return sprintf(buf, "%u\n", (bits >> bitnr) & 1);
 }
 
 static ssize_t set_beep(struct device *dev, struct device_attribute *attr,
@@ -3807,6 +5498,7 @@ static ssize_t set_beep(struct device *dev, struct device_attribute *attr,
 	int bitnr = to_sensor_dev_attr(attr)->index;
 	struct it87_data *data = dev_get_drvdata(dev);
 	long val;
+	int beeps;
 	int err;
 
 	if (kstrtol(buf, 10, &val) < 0 || (val != 0 && val != 1))
@@ -3816,12 +5508,19 @@ static ssize_t set_beep(struct device *dev, struct device_attribute *attr,
 	if (err)
 		return err;
 
-	data->beeps = data->read(data, IT87_REG_BEEP_ENABLE);
+	beeps = data->read(data, IT87_REG_BEEP_ENABLE);
+	if (beeps < 0) {
+		it87_unlock(data);
+		return beeps;
+	}
 	if (val)
-		data->beeps |= BIT(bitnr);
+		beeps |= BIT(bitnr);
 	else
-		data->beeps &= ~BIT(bitnr);
-	data->write(data, IT87_REG_BEEP_ENABLE, data->beeps);
+		beeps &= ~BIT(bitnr);
+	it87_cache_begin(data);
+	data->beeps = beeps;
+	it87_cache_end(data);
+	data->write(data, IT87_REG_BEEP_ENABLE, beeps);
 	it87_unlock(data);
 	return count;
 }
@@ -3850,43 +5549,636 @@ static SENSOR_DEVICE_ATTR(temp4_beep, S_IRUGO, show_beep, NULL, 2);
 static SENSOR_DEVICE_ATTR(temp5_beep, S_IRUGO, show_beep, NULL, 2);
 static SENSOR_DEVICE_ATTR(temp6_beep, S_IRUGO, show_beep, NULL, 2);
 
-static ssize_t show_vrm_reg(struct device *dev, struct device_attribute *attr,
-			    char *buf)
+static ssize_t show_vrm_reg(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", data->vrm);
+}
+
+static ssize_t store_vrm_reg(struct device *dev, struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	unsigned long val;
+
+	if (kstrtoul(buf, 10, &val) < 0)
+		return -EINVAL;
+
+	data->vrm = val;
+
+	return count;
+}
+static DEVICE_ATTR(vrm, S_IRUGO | S_IWUSR, show_vrm_reg, store_vrm_reg);
+
+static int it87_chip_read(struct it87_data *data, u32 attr, long *val)
+{
+	unsigned int interval = IT87_MAX_INTERVAL;
+	int i;
+
+	switch (attr) {
+	case hwmon_chip_alarms:
+		*val = data->alarms;
+		break;
+	case hwmon_chip_update_interval:
+		/* The shortest of the per class intervals */
+		for (i = 0; i < IT87_NUM_CACHE; i++)
+			if (i != IT87_CACHE_LIMIT)
+				interval = min(interval,
+					READ_ONCE(data->update_interval[i]));
+		*val = interval;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+	return 0;
+}
+
+static int it87_chip_write(struct device *dev, u32 attr, long val)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int i;
+
+	if (attr != hwmon_chip_update_interval)
+		return -EOPNOTSUPP;
+
+	val = clamp_val(val, IT87_ADC_CYCLE, IT87_MAX_INTERVAL);
+	for (i = 0; i < IT87_NUM_CACHE; i++)
+		if (i != IT87_CACHE_LIMIT)
+			WRITE_ONCE(data->update_interval[i], val);
+
+	return 0;
+}
+
+static ssize_t show_class_interval(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int nr = to_sensor_dev_attr(attr)->index;
+
+	return sprintf(buf, "%u\n", READ_ONCE(data->update_interval[nr]));
+}
+
+static ssize_t set_class_interval(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int nr = to_sensor_dev_attr(attr)->index;
+	unsigned long val;
+
+	if (kstrtoul(buf, 10, &val) < 0)
+		return -EINVAL;
+
+	val = clamp_val(val, IT87_ADC_CYCLE, IT87_MAX_INTERVAL);
+	WRITE_ONCE(data->update_interval[nr], val);
+
+	return count;
+}
+
+static SENSOR_DEVICE_ATTR(update_interval_in, S_IRUGO | S_IWUSR,
+			  show_class_interval, set_class_interval,
+			  IT87_CACHE_IN);
+static SENSOR_DEVICE_ATTR(update_interval_fan, S_IRUGO | S_IWUSR,
+			  show_class_interval, set_class_interval,
+			  IT87_CACHE_FAN);
+static SENSOR_DEVICE_ATTR(update_interval_temp, S_IRUGO | S_IWUSR,
+			  show_class_interval, set_class_interval,
+			  IT87_CACHE_TEMP);
+static SENSOR_DEVICE_ATTR(update_interval_pwm, S_IRUGO | S_IWUSR,
+			  show_class_interval, set_class_interval,
+			  IT87_CACHE_PWM);
+static SENSOR_DEVICE_ATTR(update_interval_alarm, S_IRUGO | S_IWUSR,
+			  show_class_interval, set_class_interval,
+			  IT87_CACHE_ALARM);
+static SENSOR_DEVICE_ATTR(update_interval_vid, S_IRUGO | S_IWUSR,
+			  show_class_interval, set_class_interval,
+			  IT87_CACHE_VID);
+
+static ssize_t show_vid_reg(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct it87_data *data = it87_update_device_class(dev,
+					BIT(IT87_CACHE_VID));
+	unsigned int seq;
+	u8 vid;
+
+	if (IS_ERR(data))
+		return PTR_ERR(data);
+
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		vid = data->vid;
+	} while (read_seqcount_retry(&data->seq, seq));
+
+	return sprintf(buf, "%ld\n", (long)vid_from_reg(vid, data->vrm));
+}
+static DEVICE_ATTR(cpu0_vid, S_IRUGO, show_vid_reg, NULL);
+
+static ssize_t show_backend(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%s\n", it87_backends[data->backend].name);
+}
+static DEVICE_ATTR(backend, S_IRUGO, show_backend, NULL);
+
+static ssize_t show_backend_timings(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int len = 0, i;
+
+	for (i = 0; i < IT87_NUM_BACKEND; i++)
+		if (data->backend_ns[i])
+			len += sprintf(buf + len, "%s %u\n",
+				       it87_backends[i].name,
+				       data->backend_ns[i]);
+	return len;
+}
+static DEVICE_ATTR(backend_timings, S_IRUGO, show_backend_timings, NULL);
+
+static ssize_t show_cache_age(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int len = 0, i;
+
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		struct it87_cache *cache = &data->cache[i];
+
+		if (!READ_ONCE(cache->valid)) {
+			len += sprintf(buf + len, "%s -\n", it87_cache_names[i]);
+			continue;
+		}
+		len += sprintf(buf + len, "%s %u\n", it87_cache_names[i],
+			       jiffies_to_msecs(jiffies -
+					READ_ONCE(cache->last_updated)));
+	}
+	return len;
+}
+static DEVICE_ATTR(cache_age, S_IRUGO, show_cache_age, NULL);
+
+static ssize_t show_bridge_reprograms(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	unsigned long val;
+
+	mutex_lock(&mmio_lock);
+	val = it87_h2_global.reprograms;
+	mutex_unlock(&mmio_lock);
+	return sprintf(buf, "%lu\n", val);
+}
+static DEVICE_ATTR(bridge_reprograms, S_IRUGO, show_bridge_reprograms, NULL);
+
+static ssize_t show_smbus_lease_stats(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+	int len;
+
+	mutex_lock(&data->update_lock);
+	len = sprintf(buf, "entries %lu\nsaved %lu\nforced %lu\n",
+		      data->smbus_entries, data->smbus_saved,
+		      data->smbus_forced);
+	mutex_unlock(&data->update_lock);
+	return len;
+}
+static DEVICE_ATTR(smbus_lease_stats, S_IRUGO, show_smbus_lease_stats, NULL);
+
+static ssize_t show_ecio_wait_stats(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	static const char * const labels[ECIO_WAIT_BUCKETS] = {
+		"<1us", "<4us", "<16us", "<64us", "<256us", "<1024us",
+		"<4096us", ">=4096us"
+	};
+	struct it87_ecio_stats st;
+	int len, i;
+
+	mutex_lock(&it87_ecio_lock);
+	st = it87_ecio_stats;
+	mutex_unlock(&it87_ecio_lock);
+
+	len = sprintf(buf, "waits %lu\nslept %lu\ntimeouts %lu\naverage_ns %llu\n",
+		      st.waits, st.slept, st.timeouts,
+		      (unsigned long long)st.avg_ns);
+	len += sprintf(buf + len, "degraded %d\ntrips %lu\nrejected %lu\n",
+		       READ_ONCE(it87_ecio_degraded), st.trips, st.rejected);
+	for (i = 0; i < ECIO_WAIT_BUCKETS; i++)
+		len += sprintf(buf + len, "%s %lu\n", labels[i], st.hist[i]);
+	return len;
+}
+static DEVICE_ATTR(ecio_wait_stats, S_IRUGO, show_ecio_wait_stats, NULL);
+
+/*
+ * Binary snapshot
+ *
+ * Reading the snapshot attribute returns all channels at once, as a
+ * struct it87_snapshot taken from one consistent copy of the cache, so
+ * that monitoring tools don't need to open and parse dozens of files.
+ * The layout is defined in it87_snapshot.h.
+ * Must be called with data->update_lock held, as attribute writes update
+ * the cache outside of data->seq.
+ */
+static void it87_fill_snapshot(struct it87_data *data,
+			       struct it87_snapshot *snap)
+{
+	unsigned long oldest = jiffies;
+	long val;
+	int i, j;
+
+	BUILD_BUG_ON(ARRAY_SIZE(snap->in) != NUM_VIN);
+	BUILD_BUG_ON(ARRAY_SIZE(snap->temp) != NUM_TEMP);
+	BUILD_BUG_ON(ARRAY_SIZE(snap->fan) != NUM_FAN);
+	BUILD_BUG_ON(ARRAY_SIZE(snap->pwm) != NUM_PWM);
+
+	memset(snap, 0, sizeof(*snap));
+	snap->version = IT87_SNAPSHOT_VERSION;
+	snap->size = sizeof(*snap);
+	snap->has_in = data->has_in;
+	snap->has_temp = data->has_temp;
+	snap->has_fan = data->has_fan;
+	snap->has_pwm = data->has_pwm;
+	snap->has_vid = data->has_vid;
+	snap->has_beep = data->has_beep;
+	snap->beeps = data->beeps;
+	snap->alarms = data->alarms;
+	if (data->has_vid)
+		snap->cpu0_vid = vid_from_reg(data->vid, data->vrm);
+
+	/* Limits are only re-read occasionally, they don't count */
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		unsigned long last = READ_ONCE(data->cache[i].last_updated);
+
+		if (i != IT87_CACHE_LIMIT && time_before(last, oldest))
+			oldest = last;
+	}
+	snap->timestamp = ktime_get_ns() - jiffies_to_nsecs(jiffies - oldest);
+
+	for (i = 0; i < NUM_VIN; i++) {
+		if (!(data->has_in & BIT(i)))
+			continue;
+		for (j = 0; j < 3; j++) {
+			snap->in[i].val[j] = in_from_reg(data, i,
+							 data->in[i][j]);
+			snap->in[i].raw[j] = data->in[i][j];
+		}
+		snap->in[i].alarm = (data->alarms >> (8 + i)) & 1;
+	}
+
+	for (i = 0; i < NUM_TEMP; i++) {
+		if (!(data->has_temp & BIT(i)))
+			continue;
+		for (j = 0; j < 4; j++) {
+			snap->temp[i].val[j] = TEMP_FROM_REG(data->temp[i][j]);
+			snap->temp[i].raw[j] = data->temp[i][j];
+		}
+		snap->temp[i].alarm = (data->alarms >> (16 + i)) & 1;
+	}
+
+	for (i = 0; i < NUM_FAN; i++) {
+		if (!(data->has_fan & BIT(i)))
+			continue;
+		for (j = 0; j < 2; j++) {
+			snap->fan[i].val[j] = it87_fan_speed(data, i, j);
+			snap->fan[i].raw[j] = data->fan[i][j];
+		}
+		if (!has_16bit_fans(data) && i < NUM_FAN_DIV)
+			snap->fan[i].div = DIV_FROM_REG(data->fan_div[i]);
+		snap->fan[i].alarm = (data->alarms >> it87_fan_alarm_bit[i]) & 1;
+	}
+
+	for (i = 0; i < NUM_PWM; i++) {
+		if (!(data->has_pwm & BIT(i)))
+			continue;
+		it87_pwm_read(data, hwmon_pwm_freq, i, &val);
+		snap->pwm[i].freq = val;
+		snap->pwm[i].duty = pwm_from_reg(data, data->pwm_duty[i]);
+		snap->pwm[i].enable = pwm_mode(data, i);
+		snap->pwm[i].temp_map = data->pwm_temp_map[i] + 1;
+		snap->pwm[i].ctrl = data->pwm_ctrl[i];
+	}
+}
+
+static ssize_t it87_snapshot_read(struct file *file, struct kobject *kobj,
+				  IT87_BIN_CONST struct bin_attribute *attr,
+				  char *buf, loff_t off, size_t count)
+{
+	struct it87_data *data = it87_update_device(kobj_to_dev(kobj));
+	struct it87_snapshot snap;
+
+	if (IS_ERR(data))
+		return PTR_ERR(data);
+
+	mutex_lock(&data->update_lock);
+	it87_fill_snapshot(data, &snap);
+	mutex_unlock(&data->update_lock);
+
+	return memory_read_from_buffer(buf, count, &off, &snap, sizeof(snap));
+}
+
+static struct bin_attribute bin_attr_snapshot = {
+	.attr = { .name = "snapshot", .mode = S_IRUGO },
+	.size = sizeof(struct it87_snapshot),
+	.IT87_BIN_READ = it87_snapshot_read,
+};
+
+#ifdef IT87_IIO
+/*
+ * Optional IIO device for applications sampling the sensors continuously.
+ * Its trigger fires every sampling period and the buffer handler reads the
+ * enabled channels from the chip, so samples are as fresh as the ADC allows
+ * and carry the time they were read at, independent of the hwmon cache
+ * intervals.
+ */
+struct it87_iio {
+	struct device *dev;
+	struct it87_data *data;
+	struct iio_chan_spec *chans;
+	int num_chans;			/* Not counting the timestamp */
+	struct iio_trigger *trig;
+	struct delayed_work work;
+	unsigned int period;		/* In ms */
+	unsigned long next;		/* Next trigger, in jiffies */
+	struct {
+		s32 val[NUM_VIN + NUM_TEMP + NUM_FAN];
+		s64 timestamp __aligned(8);
+	} scan;
+};
+
+static unsigned int it87_iio_class(const struct iio_chan_spec *chan)
+{
+	switch (chan->type) {
+	case IIO_VOLTAGE:
+		return BIT(IT87_CACHE_IN);
+	case IIO_TEMP:
+		return BIT(IT87_CACHE_TEMP);
+	default:
+		return BIT(IT87_CACHE_FAN);
+	}
+}
+
+/* Voltages in mV, temperatures in milli-degrees C, fan speeds in RPM */
+static s32 it87_iio_value(const struct it87_data *data,
+			  const struct iio_chan_spec *chan)
+{
+	int nr = chan->address;
+
+	switch (chan->type) {
+	case IIO_VOLTAGE:
+		return in_from_reg(data, nr, data->in[nr][0]);
+	case IIO_TEMP:
+		return TEMP_FROM_REG(data->temp[nr][0]);
+	default:
+		return it87_fan_speed(data, nr, 0);
+	}
+}
+
+static int it87_iio_read_raw(struct iio_dev *indio_dev,
+			     struct iio_chan_spec const *chan,
+			     int *val, int *val2, long mask)
+{
+	struct it87_iio *st = iio_priv(indio_dev);
+	struct it87_data *data;
+	unsigned int seq;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		data = it87_update_device_class(st->dev, it87_iio_class(chan));
+		if (IS_ERR(data))
+			return PTR_ERR(data);
+		do {
+			seq = read_seqcount_begin(&data->seq);
+			*val = it87_iio_value(data, chan);
+		} while (read_seqcount_retry(&data->seq, seq));
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		if (chan->type == IIO_ANGL_VEL) {
+			/* RPM to radians per second */
+			*val = 0;
+			*val2 = 104719755;
+			return IIO_VAL_INT_PLUS_NANO;
+		}
+		*val = 1;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		*val = MSEC_PER_SEC;
+		*val2 = READ_ONCE(st->period);
+		return IIO_VAL_FRACTIONAL;
+	}
+	return -EINVAL;
+}
+
+static int it87_iio_write_raw(struct iio_dev *indio_dev,
+			      struct iio_chan_spec const *chan,
+			      int val, int val2, long mask)
+{
+	struct it87_iio *st = iio_priv(indio_dev);
+	u64 uhz;
+
+	if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+		return -EINVAL;
+	if (val < 0 || val2 < 0)
+		return -EINVAL;
+
+	uhz = (u64)val * 1000000 + val2;
+	if (!uhz)
+		return -EINVAL;
+
+	/* Sampling faster than the ADC converts only returns duplicates */
+	WRITE_ONCE(st->period,
+		   clamp_val(div_u64(1000000000ULL + uhz / 2, uhz),
+			     IT87_ADC_CYCLE, IT87_MAX_INTERVAL));
+	return 0;
+}
+
+static const struct iio_info it87_iio_info = {
+	.read_raw = it87_iio_read_raw,
+	.write_raw = it87_iio_write_raw,
+};
+
+static irqreturn_t it87_iio_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct it87_iio *st = iio_priv(indio_dev);
+	struct it87_data *data = st->data;
+	unsigned int classes = 0;
+	int i, n = 0;
+	s64 now;
+	int err;
+
+	for (i = 0; i < st->num_chans; i++)
+		if (test_bit(i, indio_dev->active_scan_mask))
+			classes |= it87_iio_class(&st->chans[i]);
+	/* While the buffer runs, alarm pollers are notified from here */
+	classes |= BIT(IT87_CACHE_ALARM);
+
+	mutex_lock(&data->update_lock);
+	err = it87_refresh(data, classes);
+	now = iio_get_time_ns(indio_dev);
+	for (i = 0; i < st->num_chans; i++)
+		if (test_bit(i, indio_dev->active_scan_mask))
+			st->scan.val[n++] = it87_iio_value(data, &st->chans[i]);
+	mutex_unlock(&data->update_lock);
+
+	/* Drop the sample rather than push values that were never read */
+	if (!err)
+		iio_push_to_buffers_with_timestamp(indio_dev, &st->scan, now);
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+static void it87_iio_work(struct work_struct *work)
 {
-	struct it87_data *data = dev_get_drvdata(dev);
+	struct it87_iio *st = container_of(to_delayed_work(work),
+					   struct it87_iio, work);
 
-	return sprintf(buf, "%u\n", data->vrm);
+	iio_trigger_poll_nested(st->trig);
+
+	/* Keep the pace no matter how long the sample took */
+	st->next += msecs_to_jiffies(READ_ONCE(st->period));
+	if (time_before(st->next, jiffies))
+		st->next = jiffies;
+	queue_delayed_work(system_freezable_wq, &st->work,
+			   st->next - jiffies);
 }
 
-static ssize_t store_vrm_reg(struct device *dev, struct device_attribute *attr,
-			     const char *buf, size_t count)
+static int it87_iio_set_trigger_state(struct iio_trigger *trig, bool state)
 {
-	struct it87_data *data = dev_get_drvdata(dev);
-	unsigned long val;
+	struct it87_iio *st = iio_trigger_get_drvdata(trig);
 
-	if (kstrtoul(buf, 10, &val) < 0)
-		return -EINVAL;
+	if (state) {
+		st->next = jiffies;
+		queue_delayed_work(system_freezable_wq, &st->work, 0);
+	} else {
+		cancel_delayed_work_sync(&st->work);
+	}
+	return 0;
+}
 
-	data->vrm = val;
+static const struct iio_trigger_ops it87_iio_trigger_ops = {
+	.set_trigger_state = it87_iio_set_trigger_state,
+};
 
-	return count;
+static void it87_iio_chan(struct iio_chan_spec *chan, int index,
+			  enum iio_chan_type type, int channel, int nr)
+{
+	chan->type = type;
+	chan->indexed = 1;
+	chan->channel = channel;
+	chan->address = nr;
+	chan->info_mask_separate = BIT(IIO_CHAN_INFO_RAW);
+	chan->info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE);
+	chan->info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ);
+	chan->scan_index = index;
+	chan->scan_type.sign = 's';
+	chan->scan_type.realbits = 32;
+	chan->scan_type.storagebits = 32;
+	chan->scan_type.endianness = IIO_CPU;
 }
-static DEVICE_ATTR(vrm, S_IRUGO | S_IWUSR, show_vrm_reg, store_vrm_reg);
 
-static ssize_t show_vid_reg(struct device *dev, struct device_attribute *attr,
-			    char *buf)
+static int it87_iio_register(struct device *dev, const char *name)
 {
-	struct it87_data *data = it87_update_device(dev);
+	struct it87_data *data = dev_get_drvdata(dev);
+	struct iio_dev *indio_dev;
+	struct it87_iio *st;
+	int i, n = 0, err;
 
-	if (IS_ERR(data))
-		return PTR_ERR(data);
+	if (!iio)
+		return 0;
+
+	indio_dev = devm_iio_device_alloc(dev, sizeof(*st));
+	if (!indio_dev)
+		return -ENOMEM;
+
+	st = iio_priv(indio_dev);
+	st->dev = dev;
+	st->data = data;
+	st->period = IT87_ADC_CYCLE;
+	INIT_DELAYED_WORK(&st->work, it87_iio_work);
+
+	st->chans = devm_kcalloc(dev, NUM_VIN + NUM_TEMP + NUM_FAN + 1,
+				 sizeof(*st->chans), GFP_KERNEL);
+	if (!st->chans)
+		return -ENOMEM;
+
+	/* Channel numbers follow the hwmon attribute names */
+	for (i = 0; i < NUM_VIN; i++) {
+		if (data->has_in & BIT(i)) {
+			it87_iio_chan(&st->chans[n], n, IIO_VOLTAGE, i, i);
+			n++;
+		}
+	}
+	for (i = 0; i < NUM_TEMP; i++) {
+		if (data->has_temp & BIT(i)) {
+			it87_iio_chan(&st->chans[n], n, IIO_TEMP, i + 1, i);
+			n++;
+		}
+	}
+	for (i = 0; i < NUM_FAN; i++) {
+		if (data->has_fan & BIT(i)) {
+			it87_iio_chan(&st->chans[n], n, IIO_ANGL_VEL, i + 1, i);
+			n++;
+		}
+	}
+	st->num_chans = n;
+	st->chans[n] = (struct iio_chan_spec)IIO_CHAN_SOFT_TIMESTAMP(n);
+
+	indio_dev->name = name;
+	indio_dev->info = &it87_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = st->chans;
+	indio_dev->num_channels = n + 1;
+
+	st->trig = devm_iio_trigger_alloc(dev, "%s-sampler", dev_name(dev));
+	if (!st->trig)
+		return -ENOMEM;
+	st->trig->ops = &it87_iio_trigger_ops;
+	iio_trigger_set_drvdata(st->trig, st);
+
+	err = devm_iio_trigger_register(dev, st->trig);
+	if (err)
+		return err;
+	indio_dev->trig = iio_trigger_get(st->trig);
+
+	err = devm_iio_triggered_buffer_setup(dev, indio_dev, NULL,
+					      it87_iio_handler, NULL);
+	if (err)
+		return err;
 
-	return sprintf(buf, "%ld\n", (long)vid_from_reg(data->vid, data->vrm));
+	return devm_iio_device_register(dev, indio_dev);
 }
-static DEVICE_ATTR(cpu0_vid, S_IRUGO, show_vid_reg, NULL);
+#else
+static int it87_iio_register(struct device *dev, const char *name)
+{
+	if (iio)
+		dev_notice(dev, "Kernel built without IIO buffer support\n");
+	return 0;
+}
+#endif
 
-static ssize_t show_label(struct device *dev, struct device_attribute *attr,
-			  char *buf)
+/* in3, in7, in8 and in9 may be internal voltages with a fixed label */
+static int it87_in_label_index(int nr)
+{
+	switch (nr) {
+	case 3:
+		return 0;
+	case 7:
+		return 1;
+	case 8:
+		return 2;
+	case 9:		/* AVCC3 */
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+static const char *it87_in_label(const struct it87_data *data, int nr)
 {
 	static const char * const labels[] = {
 		"+5V",
@@ -3900,297 +6192,386 @@ static ssize_t show_label(struct device *dev, struct device_attribute *attr,
 		"Vbat",
 		"+3.3V",
 	};
-	struct it87_data *data = dev_get_drvdata(dev);
-	int nr = to_sensor_dev_attr(attr)->index;
-	const char *label;
+	int index = it87_in_label_index(nr);
 
-	if (has_vin3_5v(data) && nr == 0)
-		label = labels[0];
-	else if (has_scaling(data))
-		label = labels_it8721[nr];
-	else
-		label = labels[nr];
+	if (has_vin3_5v(data) && index == 0)
+		return labels[0];
+	if (has_scaling(data))
+		return labels_it8721[index];
+	return labels[index];
+}
+
+/*
+ * The standard attributes are created by the hwmon core from it87_info, and
+ * all go through it87_read() and it87_write(). Whatever has no equivalent
+ * there is in the extra attribute groups further down.
+ */
+
+/* The cache classes a read depends on */
+static unsigned int it87_read_classes(enum hwmon_sensor_types type, u32 attr)
+{
+	switch (type) {
+	case hwmon_chip:
+		return attr == hwmon_chip_alarms ? BIT(IT87_CACHE_ALARM) : 0;
+	case hwmon_in:
+		if (attr == hwmon_in_input)
+			return BIT(IT87_CACHE_IN);
+		if (attr == hwmon_in_alarm)
+			return BIT(IT87_CACHE_ALARM);
+		return BIT(IT87_CACHE_LIMIT);
+	case hwmon_temp:
+		if (attr == hwmon_temp_input)
+			return BIT(IT87_CACHE_TEMP);
+		if (attr == hwmon_temp_alarm)
+			return BIT(IT87_CACHE_ALARM);
+		return BIT(IT87_CACHE_LIMIT);
+	case hwmon_fan:
+		if (attr == hwmon_fan_alarm)
+			return BIT(IT87_CACHE_ALARM);
+		/* The divisor is needed for the limit too */
+		if (attr == hwmon_fan_min)
+			return BIT(IT87_CACHE_FAN) | BIT(IT87_CACHE_LIMIT);
+		return BIT(IT87_CACHE_FAN);
+	case hwmon_pwm:
+		return BIT(IT87_CACHE_PWM);
+	default:
+		return 0;
+	}
+}
 
-	return sprintf(buf, "%s\n", label);
+/* Must be called within a data->seq read section */
+static int it87_read_cached(struct it87_data *data,
+			    enum hwmon_sensor_types type, u32 attr,
+			    int channel, long *val)
+{
+	switch (type) {
+	case hwmon_chip:
+		return it87_chip_read(data, attr, val);
+	case hwmon_in:
+		return it87_in_read(data, attr, channel, val);
+	case hwmon_temp:
+		return it87_temp_read(data, attr, channel, val);
+	case hwmon_fan:
+		return it87_fan_read(data, attr, channel, val);
+	case hwmon_pwm:
+		return it87_pwm_read(data, attr, channel, val);
+	default:
+		return -EOPNOTSUPP;
+	}
 }
-static SENSOR_DEVICE_ATTR(in3_label, S_IRUGO, show_label, NULL, 0);
-static SENSOR_DEVICE_ATTR(in7_label, S_IRUGO, show_label, NULL, 1);
-static SENSOR_DEVICE_ATTR(in8_label, S_IRUGO, show_label, NULL, 2);
-/* AVCC3 */
-static SENSOR_DEVICE_ATTR(in9_label, S_IRUGO, show_label, NULL, 3);
 
-static umode_t it87_in_is_visible(struct kobject *kobj,
-				  struct attribute *attr, int index)
+static int it87_read(struct device *dev, enum hwmon_sensor_types type,
+		     u32 attr, int channel, long *val)
 {
-	struct device *dev = kobj_to_dev(kobj);
 	struct it87_data *data = dev_get_drvdata(dev);
-	int i = index / 5;	/* voltage index */
-	int a = index % 5;	/* attribute index */
-
-	if (index >= 40) {	/* in8 and higher only have input attributes */
-		i = index - 40 + 8;
-		a = 0;
-	}
+	unsigned int classes = it87_read_classes(type, attr);
+	unsigned int seq;
+	int ret;
 
-	if (!(data->has_in & BIT(i)))
+	/* Not cached, read from the chip under update_lock */
+	if (type == hwmon_temp && attr == hwmon_temp_type) {
+		ret = it87_read_temp_type(data, channel);
+		if (ret < 0)
+			return ret;
+		*val = ret;
 		return 0;
+	}
 
-	if (a == 4 && !data->has_beep)
-		return 0;
+	if (classes) {
+		data = it87_update_device_class(dev, classes);
+		if (IS_ERR(data))
+			return PTR_ERR(data);
+	}
 
-	return attr->mode;
+	do {
+		seq = read_seqcount_begin(&data->seq);
+		ret = it87_read_cached(data, type, attr, channel, val);
+	} while (read_seqcount_retry(&data->seq, seq));
+	return ret;
 }
 
-static struct attribute *it87_attributes_in[] = {
-	&sensor_dev_attr_in0_input.dev_attr.attr,
-	&sensor_dev_attr_in0_min.dev_attr.attr,
-	&sensor_dev_attr_in0_max.dev_attr.attr,
-	&sensor_dev_attr_in0_alarm.dev_attr.attr,
-	&sensor_dev_attr_in0_beep.dev_attr.attr,	/* 4 */
-
-	&sensor_dev_attr_in1_input.dev_attr.attr,
-	&sensor_dev_attr_in1_min.dev_attr.attr,
-	&sensor_dev_attr_in1_max.dev_attr.attr,
-	&sensor_dev_attr_in1_alarm.dev_attr.attr,
-	&sensor_dev_attr_in1_beep.dev_attr.attr,	/* 9 */
-
-	&sensor_dev_attr_in2_input.dev_attr.attr,
-	&sensor_dev_attr_in2_min.dev_attr.attr,
-	&sensor_dev_attr_in2_max.dev_attr.attr,
-	&sensor_dev_attr_in2_alarm.dev_attr.attr,
-	&sensor_dev_attr_in2_beep.dev_attr.attr,	/* 14 */
-
-	&sensor_dev_attr_in3_input.dev_attr.attr,
-	&sensor_dev_attr_in3_min.dev_attr.attr,
-	&sensor_dev_attr_in3_max.dev_attr.attr,
-	&sensor_dev_attr_in3_alarm.dev_attr.attr,
-	&sensor_dev_attr_in3_beep.dev_attr.attr,	/* 19 */
-
-	&sensor_dev_attr_in4_input.dev_attr.attr,
-	&sensor_dev_attr_in4_min.dev_attr.attr,
-	&sensor_dev_attr_in4_max.dev_attr.attr,
-	&sensor_dev_attr_in4_alarm.dev_attr.attr,
-	&sensor_dev_attr_in4_beep.dev_attr.attr,	/* 24 */
-
-	&sensor_dev_attr_in5_input.dev_attr.attr,
-	&sensor_dev_attr_in5_min.dev_attr.attr,
-	&sensor_dev_attr_in5_max.dev_attr.attr,
-	&sensor_dev_attr_in5_alarm.dev_attr.attr,
-	&sensor_dev_attr_in5_beep.dev_attr.attr,	/* 29 */
-
-	&sensor_dev_attr_in6_input.dev_attr.attr,
-	&sensor_dev_attr_in6_min.dev_attr.attr,
-	&sensor_dev_attr_in6_max.dev_attr.attr,
-	&sensor_dev_attr_in6_alarm.dev_attr.attr,
-	&sensor_dev_attr_in6_beep.dev_attr.attr,	/* 34 */
-
-	&sensor_dev_attr_in7_input.dev_attr.attr,
-	&sensor_dev_attr_in7_min.dev_attr.attr,
-	&sensor_dev_attr_in7_max.dev_attr.attr,
-	&sensor_dev_attr_in7_alarm.dev_attr.attr,
-	&sensor_dev_attr_in7_beep.dev_attr.attr,	/* 39 */
-
-	&sensor_dev_attr_in8_input.dev_attr.attr,	/* 40 */
-	&sensor_dev_attr_in9_input.dev_attr.attr,	/* 41 */
-	&sensor_dev_attr_in10_input.dev_attr.attr,	/* 42 */
-	&sensor_dev_attr_in11_input.dev_attr.attr,	/* 43 */
-	&sensor_dev_attr_in12_input.dev_attr.attr,	/* 44 */
-	NULL
-};
-
-static const struct attribute_group it87_group_in = {
-	.attrs = it87_attributes_in,
-	.is_visible = it87_in_is_visible,
-};
-
-static umode_t it87_temp_is_visible(struct kobject *kobj,
-				    struct attribute *attr, int index)
+static int it87_read_string(struct device *dev, enum hwmon_sensor_types type,
+			    u32 attr, int channel, const char **str)
 {
-	struct device *dev = kobj_to_dev(kobj);
 	struct it87_data *data = dev_get_drvdata(dev);
-	int i = index / 7;	/* temperature index */
-	int a = index % 7;	/* attribute index */
 
-	if (!(data->has_temp & BIT(i)))
-		return 0;
+	if (type != hwmon_in || attr != hwmon_in_label)
+		return -EOPNOTSUPP;
+
+	*str = it87_in_label(data, channel);
+	return 0;
+}
+
+static int it87_write(struct device *dev, enum hwmon_sensor_types type,
+		      u32 attr, int channel, long val)
+{
+	switch (type) {
+	case hwmon_chip:
+		return it87_chip_write(dev, attr, val);
+	case hwmon_in:
+		return it87_in_write(dev, attr, channel, val);
+	case hwmon_temp:
+		return it87_temp_write(dev, attr, channel, val);
+	case hwmon_fan:
+		return it87_fan_write(dev, attr, channel, val);
+	case hwmon_pwm:
+		return it87_pwm_write(dev, attr, channel, val);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static umode_t it87_in_visible(const struct it87_data *data, u32 attr, int nr)
+{
+	int index;
 
-	if (a && i >= data->num_temp_limit)
+	if (!(data->has_in & BIT(nr)))
 		return 0;
 
-	if (a == 3) {
-		if (get_temp_type(data, i) == 0)
+	switch (attr) {
+	case hwmon_in_min:
+	case hwmon_in_max:
+		return 0644;
+	case hwmon_in_label:
+		index = it87_in_label_index(nr);
+		if (index < 0 || !(data->in_internal & BIT(index)))
 			return 0;
-		if (has_bank_sel(data))
-			return 0444;
-		return attr->mode;
+		return 0444;
+	default:
+		return 0444;
 	}
+}
 
-	if (a == 5 && i >= data->num_temp_offset)
+static umode_t it87_temp_visible(const struct it87_data *data, u32 attr,
+				 int nr)
+{
+	if (!(data->has_temp & BIT(nr)))
 		return 0;
 
-	if (a == 6 && !data->has_beep)
+	if (attr != hwmon_temp_input && nr >= data->num_temp_limit)
 		return 0;
 
-	return attr->mode;
+	switch (attr) {
+	case hwmon_temp_input:
+	case hwmon_temp_alarm:
+		return 0444;
+	case hwmon_temp_type:
+		if (!(data->has_temp_type & BIT(nr)))
+			return 0;
+		return has_bank_sel(data) ? 0444 : 0644;
+	case hwmon_temp_offset:
+		return nr < data->num_temp_offset ? 0644 : 0;
+	default:
+		return 0644;
+	}
 }
 
-static struct attribute *it87_attributes_temp[] = {
-	&sensor_dev_attr_temp1_input.dev_attr.attr,
-	&sensor_dev_attr_temp1_max.dev_attr.attr,
-	&sensor_dev_attr_temp1_min.dev_attr.attr,
-	&sensor_dev_attr_temp1_type.dev_attr.attr,	/* 3 */
-	&sensor_dev_attr_temp1_alarm.dev_attr.attr,
-	&sensor_dev_attr_temp1_offset.dev_attr.attr,	/* 5 */
-	&sensor_dev_attr_temp1_beep.dev_attr.attr,	/* 6 */
-
-	&sensor_dev_attr_temp2_input.dev_attr.attr,	/* 7 */
-	&sensor_dev_attr_temp2_max.dev_attr.attr,
-	&sensor_dev_attr_temp2_min.dev_attr.attr,
-	&sensor_dev_attr_temp2_type.dev_attr.attr,
-	&sensor_dev_attr_temp2_alarm.dev_attr.attr,
-	&sensor_dev_attr_temp2_offset.dev_attr.attr,
-	&sensor_dev_attr_temp2_beep.dev_attr.attr,
+static umode_t it87_fan_visible(const struct it87_data *data, u32 attr, int nr)
+{
+	if (!(data->has_fan & BIT(nr)))
+		return 0;
 
-	&sensor_dev_attr_temp3_input.dev_attr.attr,	/* 14 */
-	&sensor_dev_attr_temp3_max.dev_attr.attr,
-	&sensor_dev_attr_temp3_min.dev_attr.attr,
-	&sensor_dev_attr_temp3_type.dev_attr.attr,
-	&sensor_dev_attr_temp3_alarm.dev_attr.attr,
-	&sensor_dev_attr_temp3_offset.dev_attr.attr,
-	&sensor_dev_attr_temp3_beep.dev_attr.attr,
+	switch (attr) {
+	case hwmon_fan_min:
+		return 0644;
+	case hwmon_fan_div:
+		/* fan 4..6 don't have divisors */
+		if (has_16bit_fans(data) || nr >= NUM_FAN_DIV)
+			return 0;
+		return 0644;
+	default:
+		return 0444;
+	}
+}
 
-	&sensor_dev_attr_temp4_input.dev_attr.attr,	/* 21 */
-	&sensor_dev_attr_temp4_max.dev_attr.attr,
-	&sensor_dev_attr_temp4_min.dev_attr.attr,
-	&sensor_dev_attr_temp4_type.dev_attr.attr,
-	&sensor_dev_attr_temp4_alarm.dev_attr.attr,
-	&sensor_dev_attr_temp4_offset.dev_attr.attr,
-	&sensor_dev_attr_temp4_beep.dev_attr.attr,
+static umode_t it87_pwm_visible(const struct it87_data *data, u32 attr, int nr)
+{
+	if (!(data->has_pwm & BIT(nr)))
+		return 0;
 
-	&sensor_dev_attr_temp5_input.dev_attr.attr,
-	&sensor_dev_attr_temp5_max.dev_attr.attr,
-	&sensor_dev_attr_temp5_min.dev_attr.attr,
-	&sensor_dev_attr_temp5_type.dev_attr.attr,
-	&sensor_dev_attr_temp5_alarm.dev_attr.attr,
-	&sensor_dev_attr_temp5_offset.dev_attr.attr,
-	&sensor_dev_attr_temp5_beep.dev_attr.attr,
+	/* pwm2_freq is writable if there are two pwm frequency selects */
+	if (attr == hwmon_pwm_freq && nr && !(nr == 1 && has_pwm_freq2(data)))
+		return 0444;
 
-	&sensor_dev_attr_temp6_input.dev_attr.attr,
-	&sensor_dev_attr_temp6_max.dev_attr.attr,
-	&sensor_dev_attr_temp6_min.dev_attr.attr,
-	&sensor_dev_attr_temp6_type.dev_attr.attr,
-	&sensor_dev_attr_temp6_alarm.dev_attr.attr,
-	&sensor_dev_attr_temp6_offset.dev_attr.attr,
-	&sensor_dev_attr_temp6_beep.dev_attr.attr,
+	return 0644;
+}
+
+static umode_t it87_is_visible(const void *drvdata,
+			       enum hwmon_sensor_types type, u32 attr,
+			       int channel)
+{
+	const struct it87_data *data = drvdata;
+
+	switch (type) {
+	case hwmon_chip:
+		return attr == hwmon_chip_update_interval ? 0644 : 0444;
+	case hwmon_in:
+		return it87_in_visible(data, attr, channel);
+	case hwmon_temp:
+		return it87_temp_visible(data, attr, channel);
+	case hwmon_fan:
+		return it87_fan_visible(data, attr, channel);
+	case hwmon_pwm:
+		return it87_pwm_visible(data, attr, channel);
+	default:
+		return 0;
+	}
+}
+
+#define IT87_IN_LIMITS	(HWMON_I_INPUT | HWMON_I_MIN | HWMON_I_MAX | \
+			 HWMON_I_ALARM)
+#define IT87_TEMP	(HWMON_T_INPUT | HWMON_T_MIN | HWMON_T_MAX | \
+			 HWMON_T_TYPE | HWMON_T_ALARM | HWMON_T_OFFSET)
+#define IT87_FAN	(HWMON_F_INPUT | HWMON_F_MIN | HWMON_F_DIV | \
+			 HWMON_F_ALARM)
+#define IT87_PWM	(HWMON_PWM_INPUT | HWMON_PWM_ENABLE | HWMON_PWM_FREQ)
+
+static const struct hwmon_channel_info *it87_info[] = {
+	HWMON_CHANNEL_INFO(chip, HWMON_C_UPDATE_INTERVAL | HWMON_C_ALARMS),
+	HWMON_CHANNEL_INFO(in,
+			   IT87_IN_LIMITS,			/* in0 */
+			   IT87_IN_LIMITS,
+			   IT87_IN_LIMITS,
+			   IT87_IN_LIMITS | HWMON_I_LABEL,	/* in3 */
+			   IT87_IN_LIMITS,
+			   IT87_IN_LIMITS,
+			   IT87_IN_LIMITS,
+			   IT87_IN_LIMITS | HWMON_I_LABEL,	/* in7 */
+			   HWMON_I_INPUT | HWMON_I_LABEL,	/* in8 */
+			   HWMON_I_INPUT | HWMON_I_LABEL,	/* in9 */
+			   HWMON_I_INPUT,
+			   HWMON_I_INPUT,
+			   HWMON_I_INPUT),			/* in12 */
+	HWMON_CHANNEL_INFO(temp,
+			   IT87_TEMP, IT87_TEMP, IT87_TEMP,
+			   IT87_TEMP, IT87_TEMP, IT87_TEMP),
+	HWMON_CHANNEL_INFO(fan,
+			   IT87_FAN, IT87_FAN, IT87_FAN,
+			   IT87_FAN, IT87_FAN, IT87_FAN),
+	HWMON_CHANNEL_INFO(pwm,
+			   IT87_PWM, IT87_PWM, IT87_PWM,
+			   IT87_PWM, IT87_PWM, IT87_PWM),
 	NULL
 };
 
-static const struct attribute_group it87_group_temp = {
-	.attrs = it87_attributes_temp,
-	.is_visible = it87_temp_is_visible,
+static const struct hwmon_ops it87_hwmon_ops = {
+	.is_visible = it87_is_visible,
+	.read = it87_read,
+	.read_string = it87_read_string,
+	.write = it87_write,
+};
+
+static const struct hwmon_chip_info it87_chip_info = {
+	.ops = &it87_hwmon_ops,
+	.info = it87_info,
 };
 
-static umode_t it87_is_visible(struct kobject *kobj,
-			       struct attribute *attr, int index)
+static umode_t it87_misc_is_visible(struct kobject *kobj,
+				    struct attribute *attr, int index)
 {
 	struct device *dev = kobj_to_dev(kobj);
 	struct it87_data *data = dev_get_drvdata(dev);
 
-	if ((index == 2 || index == 3) && !data->has_vid)
+	if ((index == 1 || index == 2) && !data->has_vid)
+		return 0;
+
+	if (index == 6 && !data->has_pwm)
+		return 0;
+
+	if (index == 8 && !data->has_vid)
 		return 0;
 
-	if (index > 3 && !(data->in_internal & BIT(index - 4)))
+	if ((index == 9 || index == 10) && !data->has_pwm)
 		return 0;
 
 	return attr->mode;
 }
 
 static struct attribute *it87_attributes[] = {
-	&dev_attr_alarms.attr,
 	&sensor_dev_attr_intrusion0_alarm.dev_attr.attr,
-	&dev_attr_vrm.attr,				/* 2 */
-	&dev_attr_cpu0_vid.attr,			/* 3 */
-	&sensor_dev_attr_in3_label.dev_attr.attr,	/* 4 .. 7 */
-	&sensor_dev_attr_in7_label.dev_attr.attr,
-	&sensor_dev_attr_in8_label.dev_attr.attr,
-	&sensor_dev_attr_in9_label.dev_attr.attr,
+	&dev_attr_vrm.attr,				/* 1 */
+	&dev_attr_cpu0_vid.attr,			/* 2 */
+	&sensor_dev_attr_update_interval_in.dev_attr.attr,	/* 3 .. 8 */
+	&sensor_dev_attr_update_interval_fan.dev_attr.attr,
+	&sensor_dev_attr_update_interval_temp.dev_attr.attr,
+	&sensor_dev_attr_update_interval_pwm.dev_attr.attr,
+	&sensor_dev_attr_update_interval_alarm.dev_attr.attr,
+	&sensor_dev_attr_update_interval_vid.dev_attr.attr,
+	&dev_attr_pwm_all.attr,				/* 9 */
+	&dev_attr_pwm_enable_all.attr,			/* 10 */
+	NULL
+};
+
+static IT87_BIN_CONST struct bin_attribute *it87_bin_attributes[] = {
+	&bin_attr_snapshot,
 	NULL
 };
 
 static const struct attribute_group it87_group = {
 	.attrs = it87_attributes,
-	.is_visible = it87_is_visible,
+	.IT87_BIN_ATTRS = it87_bin_attributes,
+	.is_visible = it87_misc_is_visible,
 };
 
-static umode_t it87_fan_is_visible(struct kobject *kobj,
-				   struct attribute *attr, int index)
+static umode_t it87_beep_is_visible(struct kobject *kobj,
+				    struct attribute *attr, int index)
 {
 	struct device *dev = kobj_to_dev(kobj);
 	struct it87_data *data = dev_get_drvdata(dev);
-	int i = index / 5;	/* fan index */
-	int a = index % 5;	/* attribute index */
-
-	if (index >= 15) {	/* fan 4..6 don't have divisor attributes */
-		i = (index - 15) / 4 + 3;
-		a = (index - 15) % 4;
-	}
+	int i;
 
-	if (!(data->has_fan & BIT(i)))
+	if (!data->has_beep)
 		return 0;
 
-	if (a == 3) {				/* beep */
-		if (!data->has_beep)
+	if (index < 8)			/* in0 .. in7 */
+		return data->has_in & BIT(index) ? attr->mode : 0;
+
+	if (index < 14) {		/* fan1 .. fan6 */
+		i = index - 8;
+		if (!(data->has_fan & BIT(i)))
 			return 0;
 		/* first fan beep attribute is writable */
 		if (i == __ffs(data->has_fan))
 			return attr->mode | S_IWUSR;
+		return attr->mode;
 	}
 
-	if (a == 4 && has_16bit_fans(data))	/* divisor */
+	i = index - 14;			/* temp1 .. temp6 */
+	if (!(data->has_temp & BIT(i)) || i >= data->num_temp_limit)
 		return 0;
 
 	return attr->mode;
 }
 
-static struct attribute *it87_attributes_fan[] = {
-	&sensor_dev_attr_fan1_input.dev_attr.attr,
-	&sensor_dev_attr_fan1_min.dev_attr.attr,
-	&sensor_dev_attr_fan1_alarm.dev_attr.attr,
-	&sensor_dev_attr_fan1_beep.dev_attr.attr,	/* 3 */
-	&sensor_dev_attr_fan1_div.dev_attr.attr,	/* 4 */
+static struct attribute *it87_attributes_beep[] = {
+	&sensor_dev_attr_in0_beep.dev_attr.attr,
+	&sensor_dev_attr_in1_beep.dev_attr.attr,
+	&sensor_dev_attr_in2_beep.dev_attr.attr,
+	&sensor_dev_attr_in3_beep.dev_attr.attr,
+	&sensor_dev_attr_in4_beep.dev_attr.attr,
+	&sensor_dev_attr_in5_beep.dev_attr.attr,
+	&sensor_dev_attr_in6_beep.dev_attr.attr,
+	&sensor_dev_attr_in7_beep.dev_attr.attr,
 
-	&sensor_dev_attr_fan2_input.dev_attr.attr,
-	&sensor_dev_attr_fan2_min.dev_attr.attr,
-	&sensor_dev_attr_fan2_alarm.dev_attr.attr,
+	&sensor_dev_attr_fan1_beep.dev_attr.attr,	/* 8 */
 	&sensor_dev_attr_fan2_beep.dev_attr.attr,
-	&sensor_dev_attr_fan2_div.dev_attr.attr,	/* 9 */
-
-	&sensor_dev_attr_fan3_input.dev_attr.attr,
-	&sensor_dev_attr_fan3_min.dev_attr.attr,
-	&sensor_dev_attr_fan3_alarm.dev_attr.attr,
 	&sensor_dev_attr_fan3_beep.dev_attr.attr,
-	&sensor_dev_attr_fan3_div.dev_attr.attr,	/* 14 */
-
-	&sensor_dev_attr_fan4_input.dev_attr.attr,	/* 15 */
-	&sensor_dev_attr_fan4_min.dev_attr.attr,
-	&sensor_dev_attr_fan4_alarm.dev_attr.attr,
 	&sensor_dev_attr_fan4_beep.dev_attr.attr,
-
-	&sensor_dev_attr_fan5_input.dev_attr.attr,	/* 19 */
-	&sensor_dev_attr_fan5_min.dev_attr.attr,
-	&sensor_dev_attr_fan5_alarm.dev_attr.attr,
 	&sensor_dev_attr_fan5_beep.dev_attr.attr,
-
-	&sensor_dev_attr_fan6_input.dev_attr.attr,	/* 23 */
-	&sensor_dev_attr_fan6_min.dev_attr.attr,
-	&sensor_dev_attr_fan6_alarm.dev_attr.attr,
 	&sensor_dev_attr_fan6_beep.dev_attr.attr,
+
+	&sensor_dev_attr_temp1_beep.dev_attr.attr,	/* 14 */
+	&sensor_dev_attr_temp2_beep.dev_attr.attr,
+	&sensor_dev_attr_temp3_beep.dev_attr.attr,
+	&sensor_dev_attr_temp4_beep.dev_attr.attr,
+	&sensor_dev_attr_temp5_beep.dev_attr.attr,
+	&sensor_dev_attr_temp6_beep.dev_attr.attr,
 	NULL
 };
 
-static const struct attribute_group it87_group_fan = {
-	.attrs = it87_attributes_fan,
-	.is_visible = it87_fan_is_visible,
+static const struct attribute_group it87_group_beep = {
+	.attrs = it87_attributes_beep,
+	.is_visible = it87_beep_is_visible,
 };
 
 static umode_t it87_pwm_is_visible(struct kobject *kobj,
@@ -4198,54 +6579,24 @@ static umode_t it87_pwm_is_visible(struct kobject *kobj,
 {
 	struct device *dev = kobj_to_dev(kobj);
 	struct it87_data *data = dev_get_drvdata(dev);
-	int i = index / 4;	/* pwm index */
-	int a = index % 4;	/* attribute index */
 
-	if (!(data->has_pwm & BIT(i)))
+	if (!(data->has_pwm & BIT(index)))
 		return 0;
 
 	/* pwmX_auto_channels_temp is only writable if auto pwm is supported */
-	if (a == 3 && (has_old_autopwm(data) || has_newer_autopwm(data)))
-		return attr->mode | S_IWUSR;
-
-	/* pwm2_freq is writable if there are two pwm frequency selects */
-	if (has_pwm_freq2(data) && i == 1 && a == 2)
+	if (has_old_autopwm(data) || has_newer_autopwm(data))
 		return attr->mode | S_IWUSR;
 
 	return attr->mode;
 }
 
 static struct attribute *it87_attributes_pwm[] = {
-	&sensor_dev_attr_pwm1_enable.dev_attr.attr,
-	&sensor_dev_attr_pwm1.dev_attr.attr,
-	&sensor_dev_attr_pwm1_freq.dev_attr.attr,
 	&sensor_dev_attr_pwm1_auto_channels_temp.dev_attr.attr,
-
-	&sensor_dev_attr_pwm2_enable.dev_attr.attr,
-	&sensor_dev_attr_pwm2.dev_attr.attr,
-	&sensor_dev_attr_pwm2_freq.dev_attr.attr,
 	&sensor_dev_attr_pwm2_auto_channels_temp.dev_attr.attr,
-
-	&sensor_dev_attr_pwm3_enable.dev_attr.attr,
-	&sensor_dev_attr_pwm3.dev_attr.attr,
-	&sensor_dev_attr_pwm3_freq.dev_attr.attr,
 	&sensor_dev_attr_pwm3_auto_channels_temp.dev_attr.attr,
-
-	&sensor_dev_attr_pwm4_enable.dev_attr.attr,
-	&sensor_dev_attr_pwm4.dev_attr.attr,
-	&sensor_dev_attr_pwm4_freq.dev_attr.attr,
 	&sensor_dev_attr_pwm4_auto_channels_temp.dev_attr.attr,
-
-	&sensor_dev_attr_pwm5_enable.dev_attr.attr,
-	&sensor_dev_attr_pwm5.dev_attr.attr,
-	&sensor_dev_attr_pwm5_freq.dev_attr.attr,
 	&sensor_dev_attr_pwm5_auto_channels_temp.dev_attr.attr,
-
-	&sensor_dev_attr_pwm6_enable.dev_attr.attr,
-	&sensor_dev_attr_pwm6.dev_attr.attr,
-	&sensor_dev_attr_pwm6_freq.dev_attr.attr,
 	&sensor_dev_attr_pwm6_auto_channels_temp.dev_attr.attr,
-
 	NULL
 };
 
@@ -4262,6 +6613,9 @@ static umode_t it87_auto_pwm_is_visible(struct kobject *kobj,
 	int i = index / 11;	/* pwm index */
 	int a = index % 11;	/* attribute index */
 
+	if (index >= 51)	/* pwmN_auto_curve */
+		return data->has_pwm & BIT(index - 51) ? attr->mode : 0;
+
 	if (index >= 33) {	/* pwm 4..6 */
 		i = (index - 33) / 6 + 3;
 		a = (index - 33) % 6 + 4;
@@ -4342,6 +6696,13 @@ static struct attribute *it87_attributes_auto_pwm[] = {
 	&sensor_dev_attr_pwm6_auto_start.dev_attr.attr,
 	&sensor_dev_attr_pwm6_auto_slope.dev_attr.attr,
 
+	&sensor_dev_attr_pwm1_auto_curve.dev_attr.attr,	/* 51 */
+	&sensor_dev_attr_pwm2_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm3_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm4_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm5_auto_curve.dev_attr.attr,
+	&sensor_dev_attr_pwm6_auto_curve.dev_attr.attr,
+
 	NULL,
 };
 
@@ -4350,6 +6711,44 @@ static const struct attribute_group it87_group_auto_pwm = {
 	.is_visible = it87_auto_pwm_is_visible,
 };
 
+/* Driver internal statistics, for diagnosing slow or flaky access paths */
+static umode_t it87_diag_is_visible(struct kobject *kobj,
+				    struct attribute *attr, int index)
+{
+	struct device *dev = kobj_to_dev(kobj);
+	struct it87_data *data = dev_get_drvdata(dev);
+
+	if (attr == &dev_attr_ecio_wait_stats.attr && !data->ecio_h2ram)
+		return 0;
+
+	if (attr == &dev_attr_smbus_lease_stats.attr && !data->smbus_bitmap)
+		return 0;
+
+	if (attr == &dev_attr_bridge_reprograms.attr && !it87_has_bridge(data))
+		return 0;
+
+	if (attr == &dev_attr_backend_timings.attr &&
+	    !data->backend_ns[data->backend])
+		return 0;
+
+	return attr->mode;
+}
+
+static struct attribute *it87_attributes_diag[] = {
+	&dev_attr_cache_age.attr,
+	&dev_attr_backend.attr,
+	&dev_attr_backend_timings.attr,
+	&dev_attr_smbus_lease_stats.attr,
+	&dev_attr_bridge_reprograms.attr,
+	&dev_attr_ecio_wait_stats.attr,
+	NULL
+};
+
+static const struct attribute_group it87_group_diag = {
+	.attrs = it87_attributes_diag,
+	.is_visible = it87_diag_is_visible,
+};
+
 /*
  * Original explanation:
  * On various Gigabyte AM4 boards (AB350, AX370), the second Super-IO chip
@@ -5203,25 +7602,18 @@ static void it87_init_regs(struct platform_device *pdev)
 	 * it87_ecio_read/write uses ECIO (special ports) and     *
 	 * conventional I/O in the same memory space              */
 	if (data->mmio) {
-		if (data->mmio_bridge) {
-			data->read  = it87_bridge_read;
-			data->write = it87_bridge_write;
-		} else if (data->mmio_h2ram) {
-			data->read  = it87_h2ram_read;
-			data->write = it87_h2ram_write;
-		} else {
-		    data->read  = it87_mmio_read;
-		    data->write = it87_mmio_write;
-		}
+		if (data->mmio_bridge)
+			it87_set_backend(data, IT87_BACKEND_BRIDGE);
+		else if (data->mmio_h2ram)
+			it87_set_backend(data, IT87_BACKEND_H2RAM);
+		else
+			it87_set_backend(data, IT87_BACKEND_MMIO);
 	} else if (data->ecio_h2ram) {
-		data->read  = it87_ecio_read;
-		data->write = it87_ecio_write;
+		it87_set_backend(data, IT87_BACKEND_ECIO);
 	} else if (has_bank_sel(data)) {
-		data->read = it87_io_read;
-		data->write = it87_io_write;
+		it87_set_backend(data, IT87_BACKEND_BANKED);
 	} else {
-		data->read = _it87_io_read;
-		data->write = _it87_io_write;
+		it87_set_backend(data, IT87_BACKEND_IO);
 	}
 }
 
@@ -5404,10 +7796,12 @@ static void it87_init_device(struct platform_device *pdev)
 	}
 
 	if (has_bank_sel(data)) {
+		it87_bank_begin(data);
 		for (i = 0; i < 3; i++)
 			data->temp_src[i] =
 				data->read(data, IT87_REG_TEMP_SRC1[i]);
 		data->temp_src[3] = data->read(data, IT87_REG_TEMP_SRC2);
+		it87_bank_end(data);
 	}
 
 	it87_start_monitoring(data);
@@ -5478,6 +7872,8 @@ static int it87_probe(struct platform_device *pdev)
 	int                    enable_pwm_interface;
 	struct device         *hwmon_dev;
 	int                    err;
+	int                    ngroups;
+	int                    i;
 
 	data = devm_kzalloc(dev, sizeof(struct it87_data), GFP_KERNEL);
 	if (!data)
@@ -5564,6 +7960,16 @@ static int it87_probe(struct platform_device *pdev)
 
 	platform_set_drvdata(pdev, data);
 	mutex_init(&data->update_lock);
+	seqcount_mutex_init(&data->seq, &data->update_lock);
+	INIT_DELAYED_WORK(&data->sampler, it87_sampler_work);
+	INIT_DELAYED_WORK(&data->smbus_work, it87_smbus_work);
+	INIT_WORK(&data->revalidate_work, it87_revalidate_work);
+	for (i = 0; i < IT87_NUM_CACHE; i++)
+		data->update_interval[i] = IT87_UPDATE_INTERVAL;
+
+	err = devm_add_action_or_reset(dev, it87_smbus_stop, data);
+	if (err)
+		return err;
 
 	/* Initialize register accessors (select IO vs MMIO backend) */
 	it87_init_regs(pdev);
@@ -5580,6 +7986,8 @@ static int it87_probe(struct platform_device *pdev)
 		return -ENODEV;
 	}
 
+	it87_select_backend(dev);
+
 	enable_pwm_interface = it87_check_pwm(dev);
 	if (!enable_pwm_interface)
 		dev_info(dev, "Detected broken BIOS defaults, disabling PWM interface\n");
@@ -5649,6 +8057,11 @@ static int it87_probe(struct platform_device *pdev)
 
 	it87_init_device(pdev);
 
+	/* Sensor types only change through tempN_type, which stays visible */
+	for (i = 0; i < NUM_TEMP; i++)
+		if ((data->has_temp & BIT(i)) && get_temp_type(data, i) > 0)
+			data->has_temp_type |= BIT(i);
+
 	smbus_enable(data);
 
 	if (!sio_data->skip_vid)
@@ -5659,24 +8072,77 @@ static int it87_probe(struct platform_device *pdev)
 	}
 
 	data->groups[0] = &it87_group;
-	data->groups[1] = &it87_group_in;
-	data->groups[2] = &it87_group_temp;
-	data->groups[3] = &it87_group_fan;
+	data->groups[1] = &it87_group_beep;
+	ngroups = 2;
 
 	if (enable_pwm_interface)
 	{
 		data->has_pwm = BIT(ARRAY_SIZE(IT87_REG_PWM)) - 1;
 		data->has_pwm &= ~sio_data->skip_pwm;
 
-		data->groups[4] = &it87_group_pwm;
+		data->groups[ngroups++] = &it87_group_pwm;
 		if (has_old_autopwm(data) || has_newer_autopwm(data))
-			data->groups[5] = &it87_group_auto_pwm;
+			data->groups[ngroups++] = &it87_group_auto_pwm;
 	}
+	data->groups[ngroups++] = &it87_group_diag;
+
+	err = it87_build_plan(dev);
+	if (err)
+		return err;
+
+	for (i = 0; i < IT87_NUM_CACHE; i++) {
+		if (data->plan[i].mmio_lo > data->plan[i].mmio_hi)
+			continue;
+		data->shadow = devm_kzalloc(dev, H2RAM_HI_BOUND + 1,
+					    GFP_KERNEL);
+		if (!data->shadow)
+			return -ENOMEM;
+		break;
+	}
+
+	err = devm_add_action_or_reset(dev, it87_sampler_stop, data);
+	if (err)
+		return err;
+
+	err = devm_add_action_or_reset(dev, it87_revalidate_stop, data);
+	if (err)
+		return err;
+
+	/*
+	 * Prime the limit cache, the store handlers keep it coherent. This
+	 * isn't a sensor read, so it doesn't start the sampler.
+	 */
+	mutex_lock(&data->update_lock);
+	err = it87_refresh(data, BIT(IT87_CACHE_LIMIT));
+	mutex_unlock(&data->update_lock);
+	if (err)
+		return err;
 
-	hwmon_dev = devm_hwmon_device_register_with_groups(dev,
+	err = it87_bridge_register(dev);
+	if (err)
+		return err;
+
+	hwmon_dev = devm_hwmon_device_register_with_info(dev,
 			     it87_devices[sio_data->type].name,
-			     data, data->groups);
-	return PTR_ERR_OR_ZERO(hwmon_dev);
+			     data, &it87_chip_info, data->groups);
+	if (IS_ERR(hwmon_dev))
+		return PTR_ERR(hwmon_dev);
+
+	mutex_lock(&data->update_lock);
+	data->hwmon_dev = hwmon_dev;
+	mutex_unlock(&data->update_lock);
+
+	err = devm_add_action_or_reset(dev, it87_alarm_detach, data);
+	if (err)
+		return err;
+
+	/* IIO is an optional extra, hwmon works without it */
+	err = it87_iio_register(dev, it87_devices[sio_data->type].name);
+	if (err)
+		dev_warn(dev, "IIO registration failed (%d), continuing without it\n",
+			 err);
+
+	return 0;
 }
 
 static void it87_resume_sio(struct platform_device *pdev)
@@ -5711,12 +8177,24 @@ static void it87_resume_sio(struct platform_device *pdev)
 	superio_exit(data->sioaddr, has_noconf(data));
 }
 
+static int it87_suspend(struct device *dev)
+{
+	struct it87_data *data = dev_get_drvdata(dev);
+
+	/* Leave SMBus shadowing to the firmware as it found it */
+	it87_smbus_flush(data);
+	return 0;
+}
+
 static int it87_resume(struct device *dev)
 {
 	struct platform_device *pdev = to_platform_device(dev);
 	struct it87_data *data = dev_get_drvdata(dev);
 	int err;
 
+	/* The firmware has reinitialized the Super-I/O configuration */
+	data->smbus_leased = false;
+
 	it87_resume_sio(pdev);
 
 	err = it87_lock(data);
@@ -5736,16 +8214,18 @@ static int it87_resume(struct device *dev)
 	it87_start_monitoring(data);
 
 	/* force update */
-	data->valid = false;
+	it87_invalidate(data, IT87_CACHE_ALL);
 
 	it87_unlock(data);
 
-	it87_update_device(dev);
+	mutex_lock(&data->update_lock);
+	it87_refresh(data, IT87_CACHE_ALL);
+	mutex_unlock(&data->update_lock);
 
 	return 0;
 }
 
-static DEFINE_SIMPLE_DEV_PM_OPS(it87_dev_pm_ops, NULL, it87_resume);
+static DEFINE_SIMPLE_DEV_PM_OPS(it87_dev_pm_ops, it87_suspend, it87_resume);
 
 static struct platform_driver it87_driver = {
 	.driver = {
@@ -6120,6 +8600,7 @@ static void __exit sm_it87_exit(void) {
 	/* NULL check handled by platform_device_unregister */
 	platform_device_unregister(it87_pdev[1]);
 	platform_device_unregister(it87_pdev[0]);
+	cancel_delayed_work_sync(&it87_ecio_probe_work);
 	it87_h2_global_release();
 	platform_driver_unregister(&it87_driver);
 }
@@ -6143,6 +8624,25 @@ module_param(fix_pwm_polarity, bool, 0);
 MODULE_PARM_DESC(fix_pwm_polarity,
 		 "Force PWM polarity to active high (DANGEROUS)");
 
+module_param(limit_refresh, uint, 0644);
+MODULE_PARM_DESC(limit_refresh,
+		 "Seconds between re-reads of limit registers (0 = never)");
+
+module_param(sample_interval, uint, 0644);
+MODULE_PARM_DESC(sample_interval,
+		 "Milliseconds between background sensor refreshes (0 = off)");
+
+module_param(max_staleness, uint, 0644);
+MODULE_PARM_DESC(max_staleness,
+		 "Milliseconds expired values may be returned while refreshing in the background (0 = off)");
+
+module_param(bench_backend, bool, 0);
+MODULE_PARM_DESC(bench_backend,
+		 "Use port I/O if it is much faster than MMIO, off by default");
+
+module_param(iio, bool, 0);
+MODULE_PARM_DESC(iio, "Register an IIO device for buffered sampling");
+
 MODULE_LICENSE("GPL");
 MODULE_VERSION(IT87_DRIVER_VERSION);
 
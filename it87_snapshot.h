@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+/*
+ *  it87_snapshot.h - Layout of the it87 snapshot attribute
+ *
+ *  Reading /sys/class/hwmon/hwmonN/device/snapshot returns one
+ *  struct it87_snapshot, in host byte order and without padding. This
+ *  header is shared by the driver and userspace tools.
+ *
+ *  Values are in the units of the corresponding attributes (mV,
+ *  millidegrees Celsius, RPM, Hz), followed by the raw register values.
+ *  Channels which don't exist read as zero.
+ *
+ *  Versioning: fields are only ever added at the end, together with a new
+ *  IT87_SNAPSHOT_VERSION. Existing fields never move or change meaning.
+ *  Readers must check that version is at least the one they were built
+ *  for, and may use size to skip fields they don't know about.
+ */
+
+#ifndef _IT87_SNAPSHOT_H
+#define _IT87_SNAPSHOT_H
+
+#include <linux/types.h>
+
+#define IT87_SNAPSHOT_VERSION	1
+
+#define IT87_SNAPSHOT_NUM_IN	13
+#define IT87_SNAPSHOT_NUM_TEMP	6
+#define IT87_SNAPSHOT_NUM_FAN	6
+#define IT87_SNAPSHOT_NUM_PWM	6
+
+struct it87_snapshot {
+	__u16 version;		/* IT87_SNAPSHOT_VERSION */
+	__u16 size;		/* sizeof(struct it87_snapshot) */
+	__u16 has_in;		/* Bitfields, channels which exist */
+	__u8 has_temp;
+	__u8 has_fan;
+	__u8 has_pwm;
+	__u8 has_vid;
+	__u8 has_beep;
+	__u8 beeps;		/* Register value */
+	__u32 alarms;		/* As in the alarms attribute */
+	__s32 cpu0_vid;		/* mV */
+	__u64 timestamp;	/* CLOCK_MONOTONIC ns of the oldest reading */
+	struct {
+		__s32 val[3];	/* input, min, max */
+		__u8 raw[3];
+		__u8 alarm;
+	} __attribute__((packed)) in[IT87_SNAPSHOT_NUM_IN];
+	struct {
+		__s32 val[4];	/* input, min, max, offset */
+		__s8 raw[4];
+		__u8 alarm;
+	} __attribute__((packed)) temp[IT87_SNAPSHOT_NUM_TEMP];
+	struct {
+		__s32 val[2];	/* input, min */
+		__u16 raw[2];
+		__u8 div;	/* 0 with 16 bit counters */
+		__u8 alarm;
+	} __attribute__((packed)) fan[IT87_SNAPSHOT_NUM_FAN];
+	struct {
+		__u32 freq;
+		__u8 duty;	/* pwmN */
+		__u8 enable;	/* pwmN_enable */
+		__u8 temp_map;	/* pwmN_auto_channels_temp */
+		__u8 ctrl;	/* Register value */
+	} __attribute__((packed)) pwm[IT87_SNAPSHOT_NUM_PWM];
+} __attribute__((packed));
+
+#endif /* _IT87_SNAPSHOT_H */
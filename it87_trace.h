@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  it87_trace.h - Trace events of the it87 driver
+ *
+ *  Chips are identified by their ISA address. Latencies are in ns, and
+ *  are only measured while the respective event is enabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM it87
+
+#if !defined(_IT87_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _IT87_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* In the order of enum it87_backend_id */
+#define it87_show_backend(id)					\
+	__print_symbolic(id, { 0, "io" }, { 1, "banked" },	\
+			 { 2, "mmio" }, { 3, "bridge" },		\
+			 { 4, "h2ram" }, { 5, "ecio" })
+
+#define it87_banked(id)		((id) == 1)
+
+/* In the order of enum it87_cache_class */
+#define it87_show_classes(classes)				\
+	__print_flags(classes, "|", { 0x01, "in" }, { 0x02, "fan" },	\
+		      { 0x04, "temp" }, { 0x08, "pwm" },		\
+		      { 0x10, "alarm" }, { 0x20, "vid" },		\
+		      { 0x40, "limit" })
+
+DECLARE_EVENT_CLASS(it87_reg,
+
+	TP_PROTO(unsigned short addr, int backend, u16 reg, int val, u64 ns),
+
+	TP_ARGS(addr, backend, reg, val, ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned short, addr)
+		__field(u8, backend)
+		__field(u16, reg)
+		__field(int, val)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->backend = backend;
+		__entry->reg = reg;
+		__entry->val = val;
+		__entry->ns = ns;
+	),
+
+	/* Only the banked backend has banks, the others print the offset */
+	TP_printk("addr=0x%x backend=%s%s%.*u reg=0x%02x val=%d ns=%llu",
+		  __entry->addr, it87_show_backend(__entry->backend),
+		  it87_banked(__entry->backend) ? " bank=" : "",
+		  it87_banked(__entry->backend),
+		  it87_banked(__entry->backend) ? __entry->reg >> 8 : 0,
+		  it87_banked(__entry->backend) ? __entry->reg & 0xff :
+						  __entry->reg,
+		  __entry->val, __entry->ns)
+);
+
+DEFINE_EVENT(it87_reg, it87_reg_read,
+	TP_PROTO(unsigned short addr, int backend, u16 reg, int val, u64 ns),
+	TP_ARGS(addr, backend, reg, val, ns)
+);
+
+DEFINE_EVENT(it87_reg, it87_reg_write,
+	TP_PROTO(unsigned short addr, int backend, u16 reg, int val, u64 ns),
+	TP_ARGS(addr, backend, reg, val, ns)
+);
+
+/* Register span copied at once into the shadow buffer */
+TRACE_EVENT(it87_burst_read,
+
+	TP_PROTO(unsigned short addr, int backend, u16 reg, unsigned int len,
+		 int err, u64 ns),
+
+	TP_ARGS(addr, backend, reg, len, err, ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned short, addr)
+		__field(u8, backend)
+		__field(u16, reg)
+		__field(unsigned int, len)
+		__field(int, err)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->backend = backend;
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->err = err;
+		__entry->ns = ns;
+	),
+
+	TP_printk("addr=0x%x backend=%s reg=0x%03x len=%u err=%d ns=%llu",
+		  __entry->addr, it87_show_backend(__entry->backend),
+		  __entry->reg, __entry->len, __entry->err, __entry->ns)
+);
+
+TRACE_EVENT(it87_refresh_begin,
+
+	TP_PROTO(unsigned short addr, unsigned int classes),
+
+	TP_ARGS(addr, classes),
+
+	TP_STRUCT__entry(
+		__field(unsigned short, addr)
+		__field(unsigned int, classes)
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->classes = classes;
+	),
+
+	TP_printk("addr=0x%x classes=%s", __entry->addr,
+		  it87_show_classes(__entry->classes))
+);
+
+/* regs counts chip accesses, including the registers of it87_burst_read */
+TRACE_EVENT(it87_refresh_end,
+
+	TP_PROTO(unsigned short addr, unsigned int classes, unsigned int regs,
+		 int ret),
+
+	TP_ARGS(addr, classes, regs, ret),
+
+	TP_STRUCT__entry(
+		__field(unsigned short, addr)
+		__field(unsigned int, classes)
+		__field(unsigned int, regs)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->classes = classes;
+		__entry->regs = regs;
+		__entry->ret = ret;
+	),
+
+	TP_printk("addr=0x%x classes=%s regs=%u ret=%d", __entry->addr,
+		  it87_show_classes(__entry->classes), __entry->regs,
+		  __entry->ret)
+);
+
+TRACE_EVENT(it87_superio_enter,
+
+	TP_PROTO(int ioreg, bool noentry, int ret),
+
+	TP_ARGS(ioreg, noentry, ret),
+
+	TP_STRUCT__entry(
+		__field(int, ioreg)
+		__field(bool, noentry)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->ioreg = ioreg;
+		__entry->noentry = noentry;
+		__entry->ret = ret;
+	),
+
+	TP_printk("ioreg=0x%x noentry=%d ret=%d", __entry->ioreg,
+		  __entry->noentry, __entry->ret)
+);
+
+TRACE_EVENT(it87_superio_exit,
+
+	TP_PROTO(int ioreg, bool noexit),
+
+	TP_ARGS(ioreg, noexit),
+
+	TP_STRUCT__entry(
+		__field(int, ioreg)
+		__field(bool, noexit)
+	),
+
+	TP_fast_assign(
+		__entry->ioreg = ioreg;
+		__entry->noexit = noexit;
+	),
+
+	TP_printk("ioreg=0x%x noexit=%d", __entry->ioreg, __entry->noexit)
+);
+
+/* H2RAM window of the ISA bridge pointed at one of the two chips */
+TRACE_EVENT(it87_bridge_slot,
+
+	TP_PROTO(u16 vendor, int slot, u32 base, bool switched, int ret,
+		 u64 ns),
+
+	TP_ARGS(vendor, slot, base, switched, ret, ns),
+
+	TP_STRUCT__entry(
+		__field(u16, vendor)
+		__field(int, slot)
+		__field(u32, base)
+		__field(bool, switched)
+		__field(int, ret)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->vendor = vendor;
+		__entry->slot = slot;
+		__entry->base = base;
+		__entry->switched = switched;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+
+	TP_printk("vendor=0x%04x slot=%d base=0x%08x switched=%d ret=%d ns=%llu",
+		  __entry->vendor, __entry->slot, __entry->base,
+		  __entry->switched, __entry->ret, __entry->ns)
+);
+
+#endif /* _IT87_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE it87_trace
+#include <trace/define_trace.h>